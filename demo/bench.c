@@ -0,0 +1,105 @@
+#define METEOROLOJI_IMPL
+#include "../meteoroloji.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Compares aggregating temperature over an array of situations with a plain
+   loop against the column kernels. No network is used, values are random. */
+
+#define DISTRICT_COUNT 1000
+#define ROUNDS 20000
+
+int value_available(double val)
+{
+    return val != -9999 && val != -99;
+}
+
+void naive_aggregate(const struct mtrlj_situation *situations, size_t size,
+                     struct mtrlj_aggregate *aggregate)
+{
+    size_t i;
+
+    aggregate->count = 0;
+    aggregate->min = 1e300;
+    aggregate->max = -1e300;
+    aggregate->sum = 0;
+
+    for (i = 0; i < size; i++) {
+        double value = situations[i].temperature;
+
+        if (!value_available(value))
+            continue;
+
+        if (value < aggregate->min)
+            aggregate->min = value;
+        if (value > aggregate->max)
+            aggregate->max = value;
+        aggregate->sum += value;
+        aggregate->count++;
+    }
+
+    aggregate->mean = aggregate->count ? aggregate->sum / aggregate->count : 0;
+}
+
+double seconds_since(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+    struct mtrlj_situation *situations;
+    struct mtrlj_situation_columns columns;
+    struct mtrlj_aggregate aggregate;
+    double *temperature;
+    unsigned char *valid;
+    double sink = 0;
+    clock_t start;
+    size_t i;
+
+    srand(42);
+    situations = calloc(DISTRICT_COUNT, sizeof(struct mtrlj_situation));
+    mtrlj_situation_columns_init(&columns, DISTRICT_COUNT);
+
+    for (i = 0; i < DISTRICT_COUNT; i++) {
+        situations[i].temperature =
+            rand() % 20 == 0 ? -9999 : (rand() % 600) / 10.0 - 20;
+        mtrlj_situation_columns_append(&columns, (int)i, situations + i);
+    }
+
+    temperature = columns.values[MTRLJ_SITUATION_TEMPERATURE];
+    valid = columns.valid[MTRLJ_SITUATION_TEMPERATURE];
+
+    start = clock();
+    for (i = 0; i < ROUNDS; i++) {
+        naive_aggregate(situations, DISTRICT_COUNT, &aggregate);
+        sink += aggregate.mean;
+    }
+    printf("naive loop over structs:   %8.2f ns/district (mean %.3f)\n",
+           seconds_since(start) * 1e9 / ROUNDS / DISTRICT_COUNT,
+           aggregate.mean);
+
+    start = clock();
+    for (i = 0; i < ROUNDS; i++) {
+        mtrlj_column_aggregate(temperature, NULL, DISTRICT_COUNT, &aggregate);
+        sink += aggregate.mean;
+    }
+    printf("kernel, sentinel checks:   %8.2f ns/district (mean %.3f)\n",
+           seconds_since(start) * 1e9 / ROUNDS / DISTRICT_COUNT,
+           aggregate.mean);
+
+    start = clock();
+    for (i = 0; i < ROUNDS; i++) {
+        mtrlj_column_aggregate(temperature, valid, DISTRICT_COUNT, &aggregate);
+        sink += aggregate.mean;
+    }
+    printf("kernel, validity bitmap:   %8.2f ns/district (mean %.3f)\n",
+           seconds_since(start) * 1e9 / ROUNDS / DISTRICT_COUNT,
+           aggregate.mean);
+
+    mtrlj_free_situation_columns(&columns);
+    free(situations);
+    return sink == 0;
+}
@@ -0,0 +1,6 @@
+#!/bin/sh
+
+rm -rf build/
+mkdir build/
+gcc -o build/bench bench.c cJSON.c -I. -ansi -Wall -Wextra -pedantic-errors -O2 -lcurl -lm -pthread
+./build/bench
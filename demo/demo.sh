@@ -2,5 +2,5 @@
 
 rm -rf build/
 mkdir build/
-gcc -o build/demo demo.c cJSON.c -I. -ansi -Wall -Wextra -pedantic-errors -ggdb -lcurl
+gcc -o build/demo demo.c cJSON.c -I. -ansi -Wall -Wextra -pedantic-errors -ggdb -lcurl -lm -pthread
 ./build/demo
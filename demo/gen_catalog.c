@@ -0,0 +1,161 @@
+#define METEOROLOJI_IMPL
+#include "../meteoroloji.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Downloads the whole catalog and writes it as C tables for
+   METEOROLOJI_EMBED_CATALOG. Usage: gen_catalog [output file] */
+
+struct names {
+    unsigned char *bytes;
+    size_t size, capacity;
+};
+
+size_t add_name(struct names *names, const char *name)
+{
+    size_t offset = names->size;
+    size_t length = strlen(name) + 1;
+
+    while (names->size + length > names->capacity) {
+        names->capacity = names->capacity ? names->capacity * 2 : 4096;
+        names->bytes = realloc(names->bytes, names->capacity);
+    }
+
+    memcpy(names->bytes + names->size, name, length);
+    names->size += length;
+    return offset;
+}
+
+int compare_plate(const void *a, const void *b)
+{
+    const struct mtrlj_district *x = (const struct mtrlj_district *)a;
+    const struct mtrlj_district *y = (const struct mtrlj_district *)b;
+
+    if (x->city_plate_code != y->city_plate_code)
+        return x->city_plate_code - y->city_plate_code;
+    /* qsort is not stable, keep MGM's order inside a city with ids */
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+void write_districts(FILE *out, const char *table,
+                     const struct mtrlj_district *districts, size_t size,
+                     struct names *names)
+{
+    size_t i;
+
+    fprintf(out, "static const struct mtrlj_district %s[] = {\n", table);
+    for (i = 0; i < size; i++) {
+        const struct mtrlj_district *d = districts + i;
+
+        fprintf(out,
+                "    {%d, %d, %d, %d, %.10g, %.10g,\n"
+                "     (char *)mtrlj_embedded_names + %lu,\n"
+                "     (char *)mtrlj_embedded_names + %lu, %d},\n",
+                d->id, d->height, d->daily_forecast_station,
+                d->hourly_forecast_station, d->longitude, d->latitude,
+                (unsigned long)add_name(names, d->name),
+                (unsigned long)add_name(names, d->city_name),
+                d->city_plate_code);
+    }
+    fprintf(out, "};\n\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "meteoroloji_catalog.h";
+    struct mtrlj_catalog catalog;
+    struct names names = {0};
+    char *tables;
+    size_t tables_size;
+    FILE *out;
+    FILE *memory;
+    int plate_count = 1;
+    size_t i, j;
+
+    if (mtrlj_catalog_load(&catalog) != MTRLJ_OK) {
+        fprintf(stderr, "Could not download the catalog\n");
+        return 1;
+    }
+
+    qsort(catalog.cities, catalog.city_count, sizeof(struct mtrlj_district),
+          compare_plate);
+    qsort(catalog.districts, catalog.size, sizeof(struct mtrlj_district),
+          compare_plate);
+
+    for (i = 0; i < catalog.city_count; i++) {
+        if (catalog.cities[i].city_plate_code >= plate_count)
+            plate_count = catalog.cities[i].city_plate_code + 1;
+    }
+
+    /* names are known only after the tables, so tables go to a temporary
+       file first */
+    memory = tmpfile();
+    if (memory == NULL) {
+        fprintf(stderr, "Could not create a temporary file\n");
+        return 1;
+    }
+
+    write_districts(memory, "mtrlj_embedded_cities", catalog.cities,
+                    catalog.city_count, &names);
+    write_districts(memory, "mtrlj_embedded_districts", catalog.districts,
+                    catalog.size, &names);
+
+    fprintf(memory, "/* districts of plate code p are [offsets[p], "
+                    "offsets[p + 1]) */\n");
+    fprintf(memory, "static const size_t mtrlj_embedded_plate_offsets[] = {");
+    for (i = 0, j = 0; i <= (size_t)plate_count; i++) {
+        while (j < catalog.size
+               && (size_t)catalog.districts[j].city_plate_code < i)
+            j++;
+        fprintf(memory, "%s%lu", i % 12 == 0 ? "\n    " : " ",
+                (unsigned long)j);
+        if (i < (size_t)plate_count)
+            fprintf(memory, ",");
+    }
+    fprintf(memory, "};\n");
+
+    tables_size = (size_t)ftell(memory);
+    tables = malloc(tables_size);
+    rewind(memory);
+    if (fread(tables, 1, tables_size, memory) != tables_size) {
+        fprintf(stderr, "Could not read the temporary file\n");
+        return 1;
+    }
+    fclose(memory);
+
+    out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return 1;
+    }
+
+    fprintf(out, "/* Generated by demo/gen_catalog.c, do not edit. */\n\n");
+    fprintf(out, "#define MTRLJ_EMBEDDED_CITY_COUNT %lu\n",
+            (unsigned long)catalog.city_count);
+    fprintf(out, "#define MTRLJ_EMBEDDED_DISTRICT_COUNT %lu\n\n",
+            (unsigned long)catalog.size);
+
+    /* a char array, C90 compilers may not like long string literals */
+    fprintf(out, "static const char mtrlj_embedded_names[] = {");
+    for (i = 0; i < names.size; i++) {
+        fprintf(out, "%s%d", i % 12 == 0 ? "\n    " : " ",
+                (int)(signed char)names.bytes[i]);
+        if (i + 1 < names.size)
+            fprintf(out, ",");
+    }
+    fprintf(out, "};\n\n");
+
+    fwrite(tables, 1, tables_size, out);
+    fclose(out);
+
+    printf("Wrote %lu cities and %lu districts to %s\n",
+           (unsigned long)catalog.city_count, (unsigned long)catalog.size,
+           path);
+
+    free(tables);
+    free(names.bytes);
+    mtrlj_free_catalog(&catalog);
+    return 0;
+}
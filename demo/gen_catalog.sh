@@ -0,0 +1,6 @@
+#!/bin/sh
+
+rm -rf build/
+mkdir build/
+gcc -o build/gen_catalog gen_catalog.c cJSON.c -I. -ansi -Wall -Wextra -pedantic-errors -ggdb -lcurl -lm -pthread
+./build/gen_catalog ../meteoroloji_catalog.h
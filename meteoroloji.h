@@ -33,9 +33,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
    For using in other files just use `#include "meteoroloji.h"`.
 
    meteoroloji.h uses curl and cJSON. Linking with curl is trivial, use
-   `-lcurl`. For cJSON, either use it from your distribution (debian/rpm/arch
-   has it.) or add cJSON.h and cJSON.c files to your project and compile them
-   too. You can look at demo/ directory for a minimal setup.
+   `-lcurl` (and `-lm -pthread` for math and threads). For cJSON, either use
+   it from your distribution (debian/rpm/arch has it.) or add cJSON.h and
+   cJSON.c files to your project and compile them too. You can look at demo/
+   directory for a minimal setup.
 */
 
 #ifndef METEOROLOJI_H_
@@ -47,7 +48,8 @@ typedef enum {
     MTRLJ_OK = 0,
     MTRLJ_REQUEST_FAILED,
     MTRLJ_JSON_PARSING_FAILED,
-    MTRLJ_NOT_AVAILABLE
+    MTRLJ_NOT_AVAILABLE,
+    MTRLJ_BUFFER_TOO_SMALL
 } MTRLJ_CODE;
 
 /* I am not so sure about translations but should be OK. */
@@ -138,6 +140,10 @@ struct mtrlj_situation {
         rainfall_12_hours, rainfall_24_hours;
 
     struct mtrlj_time time;
+
+    /* Seconds since MGM was asked for this, 0 unless it came from the cache.
+       See mtrlj_set_stale_while_revalidate. */
+    long age;
 };
 
 /* Daily forecast information */
@@ -166,10 +172,16 @@ struct mtrlj_hourly_forecast {
     double wind_speed_max;
     double wind_direction;
     struct mtrlj_time time;
+    long age; /* same as in struct mtrlj_situation */
 };
 
 /* Functions for getting information about city and districts, also you need
-   these for getting the actual weather information. */
+   these for getting the actual weather information.
+
+   If METEOROLOJI_EMBED_CATALOG is defined for the implementation, these are
+   answered from `meteoroloji_catalog.h` (generate it with demo/gen_catalog.sh)
+   without any request. Then names of returned districts point into read-only
+   tables, don't modify them; freeing them is still fine. */
 MTRLJ_CODE mtrlj_get_cities(struct mtrlj_district **cities, size_t *size);
 MTRLJ_CODE mtrlj_get_district(struct mtrlj_district *district,
                               const char *city_name, const char *district_name);
@@ -185,31 +197,705 @@ MTRLJ_CODE mtrlj_hourly_forecasts(struct mtrlj_district district,
                                   struct mtrlj_hourly_forecast **forecasts,
                                   size_t *size);
 
+/* Same as above but results are written into arrays you own and no memory is
+   allocated for them. If the array is too small, MTRLJ_BUFFER_TOO_SMALL is
+   returned and `size` (and `names_size`) is set to what would be needed.
+   District names are written into `names`, so it should live as long as the
+   districts do. Five days forecast always needs room for 5 forecasts. */
+MTRLJ_CODE mtrlj_get_districts_in_city_buf(struct mtrlj_district *districts,
+                                           size_t capacity, size_t *size,
+                                           char *names, size_t names_capacity,
+                                           size_t *names_size,
+                                           const char *city_name);
+MTRLJ_CODE mtrlj_five_days_forecast_buf(struct mtrlj_district district,
+                                        struct mtrlj_daily_forecast *forecasts);
+MTRLJ_CODE mtrlj_hourly_forecasts_buf(struct mtrlj_district district,
+                                      struct mtrlj_hourly_forecast *forecasts,
+                                      size_t capacity, size_t *size);
+
+/* Columnar (structure of arrays) results, handy when you are scanning one
+   field over lots of districts. Instead of -99/-9999, availability of a value
+   is kept in a bitmap per column, use MTRLJ_COLUMN_VALID for checking it. */
+#define MTRLJ_COLUMN_VALID(bitmap, i) (((bitmap)[(i) >> 3] >> ((i) & 7)) & 1)
+
+typedef enum {
+    MTRLJ_SITUATION_ACTUAL_PRESSURE = 0,
+    MTRLJ_SITUATION_REDUCED_PRESSURE_AT_SEA,
+    MTRLJ_SITUATION_SEA_TEMPERATURE,
+    MTRLJ_SITUATION_SNOW_HEIGHT,
+    MTRLJ_SITUATION_HUMIDITY_PERCENT,
+    MTRLJ_SITUATION_WIND_SPEED,
+    MTRLJ_SITUATION_WIND_DIRECTION,
+    MTRLJ_SITUATION_CLOUDINESS_PERCENT,
+    MTRLJ_SITUATION_TEMPERATURE,
+    MTRLJ_SITUATION_RAINFALL,
+    MTRLJ_SITUATION_RAINFALL_10_MINS,
+    MTRLJ_SITUATION_RAINFALL_1_HOUR,
+    MTRLJ_SITUATION_RAINFALL_6_HOURS,
+    MTRLJ_SITUATION_RAINFALL_12_HOURS,
+    MTRLJ_SITUATION_RAINFALL_24_HOURS,
+    MTRLJ_SITUATION_FIELD_COUNT
+} MTRLJ_SITUATION_FIELD;
+
+typedef enum {
+    MTRLJ_HOURLY_TEMPERATURE = 0,
+    MTRLJ_HOURLY_FELT_TEMPERATURE,
+    MTRLJ_HOURLY_HUMIDITY_PERCENT,
+    MTRLJ_HOURLY_WIND_SPEED_AVG,
+    MTRLJ_HOURLY_WIND_SPEED_MAX,
+    MTRLJ_HOURLY_WIND_DIRECTION,
+    MTRLJ_HOURLY_FIELD_COUNT
+} MTRLJ_HOURLY_FIELD;
+
+/* e.g. `columns.values[MTRLJ_SITUATION_TEMPERATURE][i]` is the temperature of
+   district `columns.district_id[i]`. */
+struct mtrlj_situation_columns {
+    size_t size, capacity;
+    int *district_id;
+    MTRLJ_WEATHER_CONDITION *condition;
+    struct mtrlj_time *time;
+    double *values[MTRLJ_SITUATION_FIELD_COUNT];
+    unsigned char *valid[MTRLJ_SITUATION_FIELD_COUNT];
+};
+
+struct mtrlj_hourly_forecast_columns {
+    size_t size, capacity;
+    int *district_id;
+    MTRLJ_WEATHER_CONDITION *condition;
+    struct mtrlj_time *time;
+    double *values[MTRLJ_HOURLY_FIELD_COUNT];
+    unsigned char *valid[MTRLJ_HOURLY_FIELD_COUNT];
+};
+
+void mtrlj_situation_columns_init(struct mtrlj_situation_columns *columns,
+                                  size_t capacity);
+void mtrlj_situation_columns_append(struct mtrlj_situation_columns *columns,
+                                    int district_id,
+                                    const struct mtrlj_situation *situation);
+void mtrlj_hourly_forecast_columns_init(
+    struct mtrlj_hourly_forecast_columns *columns, size_t capacity);
+void mtrlj_hourly_forecast_columns_append(
+    struct mtrlj_hourly_forecast_columns *columns, int district_id,
+    const struct mtrlj_hourly_forecast *forecast);
+
+/* These append to the columns, so you can collect many districts in one set.
+   Districts that fail are skipped and the first error is returned. */
+MTRLJ_CODE
+mtrlj_latest_situation_columns(const struct mtrlj_district *districts,
+                               size_t size,
+                               struct mtrlj_situation_columns *columns);
+MTRLJ_CODE
+mtrlj_hourly_forecasts_columns(struct mtrlj_district district,
+                               struct mtrlj_hourly_forecast_columns *columns);
+
+/* Aggregates over a column, e.g. values[MTRLJ_SITUATION_TEMPERATURE] with its
+   valid bitmap. If `valid` is NULL, -99 and -9999 values are skipped instead.
+   These use SSE2/AVX2 when the CPU has them, define METEOROLOJI_NO_SIMD before
+   the implementation to always use plain loops. When there is no value at
+   all, count is 0 and the others are -9999. */
+struct mtrlj_aggregate {
+    size_t count;
+    double min, max, sum, mean;
+};
+
+void mtrlj_column_aggregate(const double *values, const unsigned char *valid,
+                            size_t size, struct mtrlj_aggregate *aggregate);
+
+/* Same but rows are grouped with `group` (e.g. plate code of each row's city)
+   into `aggregates`, which should have `group_count` elements. Rows with a
+   group out of range are ignored. */
+void mtrlj_column_aggregate_grouped(const double *values,
+                                    const unsigned char *valid, size_t size,
+                                    const int *group, size_t group_count,
+                                    struct mtrlj_aggregate *aggregates);
+
+/* Percentiles (0-100) with linear interpolation between closest ranks. */
+MTRLJ_CODE mtrlj_column_percentiles(const double *values,
+                                    const unsigned char *valid, size_t size,
+                                    const double *percents, size_t count,
+                                    double *results);
+
+/* Wind is a vector, so directions can't be averaged like other columns. This
+   sums the wind vectors of rows where both speed and direction are available.
+   `speed` is the length of the mean vector and `direction` where it blows from
+   (degrees, 0-360). `steadiness` is between 0 (cancelling each other) and 1
+   (all from the same direction). If `speed` column is NULL only directions are
+   averaged, then `speed` is the same as `steadiness`. */
+struct mtrlj_wind_mean {
+    size_t count;
+    double speed, direction, steadiness;
+};
+
+void mtrlj_wind_vector_mean(const double *speed,
+                            const unsigned char *speed_valid,
+                            const double *direction,
+                            const unsigned char *direction_valid, size_t size,
+                            struct mtrlj_wind_mean *mean);
+
+/* Strongest gust, e.g. over MTRLJ_HOURLY_WIND_SPEED_MAX. -9999 if none. */
+double mtrlj_wind_max_gust(const double *speed, const unsigned char *valid,
+                           size_t size);
+
+/* Every city and district MGM knows about, kept in memory so questions about
+   them can be answered without asking MGM again. Fields after `size` are
+   indexes built by the library, don't touch them. */
+struct mtrlj_catalog {
+    struct mtrlj_district *cities;
+    size_t city_count;
+    struct mtrlj_district *districts;
+    size_t size;
+
+    /* uniform latitude/longitude grid over districts */
+    double grid_latitude, grid_longitude, grid_cell_size, grid_min_cos;
+    size_t grid_rows, grid_columns;
+    size_t *grid_start;
+    size_t *grid_items;
+
+    /* open addressing hash table of folded (city, district) names */
+    size_t name_capacity;
+    size_t *name_slots;
+
+    /* folded names of districts and then cities, and their sorted order */
+    char *search_names;
+    size_t *search_offsets;
+    size_t *search_order;
+
+    /* tables indexed by plate code, merkezId and station numbers */
+    size_t plate_count;
+    size_t *plate_slots;
+    int id_min, daily_station_min, hourly_station_min;
+    size_t id_count, daily_station_count, hourly_station_count;
+    size_t *id_slots;
+    size_t *daily_station_slots;
+    size_t *hourly_station_slots;
+};
+
+/* Downloads cities and then districts of every city (82 requests). */
+MTRLJ_CODE mtrlj_catalog_load(struct mtrlj_catalog *catalog);
+
+/* Builds a catalog from districts you already have, catalog takes ownership
+   of the arrays and frees them in mtrlj_free_catalog. */
+void mtrlj_catalog_init(struct mtrlj_catalog *catalog,
+                        struct mtrlj_district *cities, size_t city_count,
+                        struct mtrlj_district *districts, size_t size);
+
+/* Up to `k` districts closest to the given coordinates, closest first. Returns
+   how many are written into `nearest`. */
+size_t mtrlj_nearest_district(const struct mtrlj_catalog *catalog,
+                              double latitude, double longitude, size_t k,
+                              const struct mtrlj_district **nearest);
+
+/* Districts in `radius` kilometers, returns how many there are, even if more
+   than `capacity`. */
+size_t mtrlj_districts_within(const struct mtrlj_catalog *catalog,
+                              double latitude, double longitude, double radius,
+                              const struct mtrlj_district **districts,
+                              size_t capacity);
+
+/* Great circle distance in kilometers. */
+double mtrlj_distance(double latitude1, double longitude1, double latitude2,
+                      double longitude2);
+
+/* Folds a name so differently typed versions of it compare equal. Case and
+   diacritics are dropped, so `İ`, `I`, `ı` and `i` all become `i`, `Ş` becomes
+   `s` and so on; spaces are trimmed and collapsed. Writes at most `capacity`
+   bytes including the terminator and returns the folded length. */
+size_t mtrlj_fold_name(const char *name, char *folded, size_t capacity);
+
+/* Finds a district by names without a request, using the folded names. An
+   empty or NULL `district_name` gives the city itself. NULL if not found. */
+const struct mtrlj_district *
+mtrlj_catalog_find(const struct mtrlj_catalog *catalog, const char *city_name,
+                   const char *district_name);
+
+/* Autocompletion over district and city names. Names starting with `prefix`
+   (compared folded), shortest first. Returns how many are written. */
+size_t mtrlj_catalog_complete(const struct mtrlj_catalog *catalog,
+                              const char *prefix,
+                              const struct mtrlj_district **matches, size_t k);
+
+/* Same but tolerates typos, names whose beginning is at most `max_distance`
+   edits away from `query`, closest first. */
+size_t mtrlj_catalog_search(const struct mtrlj_catalog *catalog,
+                            const char *query, size_t max_distance,
+                            const struct mtrlj_district **matches, size_t k);
+
+/* Constant time lookups with numbers, NULL if there is no such thing. A city
+   is found with its plate code, a district with its `id` (merkezId) or one of
+   its forecast stations. Stations may be shared, then you get the first. */
+const struct mtrlj_district *
+mtrlj_city_by_plate(const struct mtrlj_catalog *catalog, int plate_code);
+const struct mtrlj_district *
+mtrlj_district_by_id(const struct mtrlj_catalog *catalog, int id);
+const struct mtrlj_district *
+mtrlj_district_by_daily_station(const struct mtrlj_catalog *catalog,
+                                int station);
+const struct mtrlj_district *
+mtrlj_district_by_hourly_station(const struct mtrlj_catalog *catalog,
+                                 int station);
+
+/* Change detection. A tracker remembers the veriZamani, a content hash and
+   the values of the last situation of every district it has seen, so after
+   each poll you get only what changed. Bits of `fields` are the
+   MTRLJ_SITUATION_* fields (see MTRLJ_FIELD_BIT) plus the ones below. */
+#define MTRLJ_FIELD_BIT(field) (1UL << (field))
+#define MTRLJ_CHANGED_CONDITION MTRLJ_FIELD_BIT(MTRLJ_SITUATION_FIELD_COUNT)
+#define MTRLJ_CHANGED_TIME MTRLJ_FIELD_BIT(MTRLJ_SITUATION_FIELD_COUNT + 1)
+#define MTRLJ_CHANGED_NEW MTRLJ_FIELD_BIT(MTRLJ_SITUATION_FIELD_COUNT + 2)
+
+struct mtrlj_change {
+    int district_id;
+    unsigned long fields;
+};
+
+struct mtrlj_change_tracker {
+    struct mtrlj_tracked_situation *slots;
+    size_t capacity, size;
+};
+
+void mtrlj_change_tracker_init(struct mtrlj_change_tracker *tracker);
+
+/* Returns what changed since the last situation of the district, 0 if
+   nothing, and remembers this one. District id 0 isn't tracked, it always
+   gets 0. */
+unsigned long mtrlj_track_situation(struct mtrlj_change_tracker *tracker,
+                                    int district_id,
+                                    const struct mtrlj_situation *situation);
+
+/* Same for every row of `columns`. Changed districts are written into
+   `changes`, which needs room for `columns->size` of them, and their count is
+   returned. */
+size_t
+mtrlj_track_situation_columns(struct mtrlj_change_tracker *tracker,
+                              const struct mtrlj_situation_columns *columns,
+                              struct mtrlj_change *changes);
+
+/* Polling scheduler. MGM stations publish at their own pace, so instead of
+   polling everything on a fixed timer it learns the cadence of each district
+   from successive veriZamani values and polls it just after its next
+   publication is expected. Until it has seen two publications of a district,
+   `default_interval` seconds are used. Times are unix times. */
+struct mtrlj_poll_schedule {
+    const struct mtrlj_district *districts;
+    size_t size;
+    long default_interval;
+
+    /* per district, in the order of `districts` */
+    long *next_due;  /* when it should be polled next */
+    long *cadence;   /* seconds between publications, 0 if not known yet */
+    long *lag;       /* seconds between veriZamani and it showing up */
+    long *last_data; /* last veriZamani */
+};
+
+/* `districts` should live as long as the schedule, everything is due at
+   first. */
+void mtrlj_poll_schedule_init(struct mtrlj_poll_schedule *schedule,
+                              const struct mtrlj_district *districts,
+                              size_t size, long default_interval);
+
+/* Fetches latest situation of the districts due at `now`, appends them into
+   `columns` (if not NULL) and reschedules them. Returns how many were
+   fetched, failed ones are tried again after `default_interval`. */
+size_t mtrlj_poll_due(struct mtrlj_poll_schedule *schedule, long now,
+                      struct mtrlj_situation_columns *columns);
+
+/* If you fetch them yourself, tell the schedule what you got. */
+void mtrlj_poll_observe(struct mtrlj_poll_schedule *schedule, size_t index,
+                        const struct mtrlj_time *time, long now);
+
+/* Earliest next due time, sleep until then. */
+long mtrlj_poll_next_wakeup(const struct mtrlj_poll_schedule *schedule);
+
+/* Subscriptions. A library owned thread polls what is subscribed and calls
+   `callback` from that thread whenever it changes, and once right after
+   subscribing when there is something to tell. Subscriptions to the same
+   district and product share one fetch. Latest situations are polled with
+   their learned cadence, forecasts every `mtrlj_set_poll_interval` seconds
+   (10 minutes by default). Strings of `district` should outlive the
+   subscription. */
+typedef enum {
+    MTRLJ_SUBSCRIBE_SITUATION = 1,
+    MTRLJ_SUBSCRIBE_FIVE_DAYS = 2,
+    MTRLJ_SUBSCRIBE_HOURLY = 4
+} MTRLJ_SUBSCRIBE_PRODUCT;
+
+/* Only the pointer of `product` is set. They are valid during the call. */
+struct mtrlj_update {
+    struct mtrlj_district district;
+    MTRLJ_SUBSCRIBE_PRODUCT product;
+    const struct mtrlj_situation *situation;
+    const struct mtrlj_daily_forecast *five_days; /* 5 of them */
+    const struct mtrlj_hourly_forecast *hourly;
+    size_t hourly_size;
+};
+
+typedef void (*mtrlj_update_callback)(const struct mtrlj_update *update,
+                                      void *ctx);
+
+/* `products` is an OR of MTRLJ_SUBSCRIBE_*. Returns an id for unsubscribing,
+   or -1 if the poll thread couldn't be started. */
+int mtrlj_subscribe(struct mtrlj_district district, int products,
+                    mtrlj_update_callback callback, void *ctx);
+
+/* A callback running on the poll thread at that moment may still finish. */
+MTRLJ_CODE mtrlj_unsubscribe(int id);
+
+MTRLJ_CODE mtrlj_set_poll_interval(long seconds);
+
+/* Event loop integration, for when no thread can block on MGM. The library
+   tells which sockets to watch for which events through `watch` (0 events
+   means stop watching `fd`) and when to call mtrlj_loop_timeout through
+   `timer` (-1 means cancel the timer), the loop tells it back what
+   happened. Requests complete through their callbacks from within these
+   calls, without any thread. Works with epoll, libuv, libevent and such. */
+#define MTRLJ_EVENT_IN 1
+#define MTRLJ_EVENT_OUT 2
+#define MTRLJ_EVENT_ERROR 4
+
+struct mtrlj_loop;
+
+typedef void (*mtrlj_watch_callback)(int fd, int events, void *ctx);
+typedef void (*mtrlj_timer_callback)(long milliseconds, void *ctx);
+
+struct mtrlj_loop *mtrlj_loop_new(mtrlj_watch_callback watch,
+                                  mtrlj_timer_callback timer, void *ctx);
+
+/* `events` is an OR of MTRLJ_EVENT_*. */
+void mtrlj_loop_socket_ready(struct mtrlj_loop *loop, int fd, int events);
+void mtrlj_loop_timeout(struct mtrlj_loop *loop);
+
+/* Requests still waiting for MGM. When the loop is freed (not from a
+   callback) they complete with MTRLJ_REQUEST_FAILED. */
+size_t mtrlj_loop_pending(const struct mtrlj_loop *loop);
+
+/* Only the pointer of the requested product in `update` is set, and only if
+   `code` is MTRLJ_OK. They are valid during the call. */
+typedef void (*mtrlj_loop_callback)(MTRLJ_CODE code,
+                                    const struct mtrlj_update *update,
+                                    void *ctx);
+
+/* These return MTRLJ_OK and call `callback` once when done, right away if
+   the answer is in a cache. Other codes are known without asking MGM, then
+   `callback` isn't called. Retries, hedging, rate limit and transfer slots
+   are up to the loop; caches, call timeout and circuit breakers apply. */
+MTRLJ_CODE mtrlj_loop_latest_situation(struct mtrlj_loop *loop,
+                                       struct mtrlj_district district,
+                                       mtrlj_loop_callback callback,
+                                       void *ctx);
+MTRLJ_CODE mtrlj_loop_hourly_forecasts(struct mtrlj_loop *loop,
+                                       struct mtrlj_district district,
+                                       mtrlj_loop_callback callback,
+                                       void *ctx);
+
+/* Resumable operations, for calls needing more than one request. They are
+   state machines on an event loop: mtrlj_op_step advances one as far as the
+   finished requests let it, sending the next ones, and returns
+   MTRLJ_OP_DONE when it is over. In between, `ready` is called from the
+   loop's callbacks whenever stepping again would get further, so
+   coroutines can await it. Nothing is sent before the first step. */
+typedef enum {
+    MTRLJ_OP_PENDING = 0, /* waiting for MGM */
+    MTRLJ_OP_READY,       /* step it */
+    MTRLJ_OP_DONE
+} MTRLJ_OP_STATE;
+
+struct mtrlj_op;
+
+/* The daily forecast, then past values of the 5 days at the same time.
+   `forecasts` has room for 5 and should live until the op is done. */
+struct mtrlj_op *
+mtrlj_five_days_forecast_op(struct mtrlj_loop *loop,
+                            struct mtrlj_district district,
+                            struct mtrlj_daily_forecast *forecasts);
+
+/* Same as mtrlj_catalog_load, cities then their districts a few at a time. */
+struct mtrlj_op *mtrlj_catalog_load_op(struct mtrlj_loop *loop,
+                                       struct mtrlj_catalog *catalog);
+
+void mtrlj_op_on_ready(struct mtrlj_op *op, void (*ready)(void *ctx),
+                       void *ctx);
+MTRLJ_OP_STATE mtrlj_op_step(struct mtrlj_op *op);
+
+/* Doesn't advance it. `code` is set once it is done. An op can be freed
+   before it is done, requests on their way are left to finish. */
+MTRLJ_OP_STATE mtrlj_op_poll(const struct mtrlj_op *op, MTRLJ_CODE *code);
+
+/* Thread pool for the blocking calls. mtrlj_submit_* queue a call and
+   return a handle right away, mtrlj_wait waits for it, returns its code and
+   frees the handle. Every handle should be waited. Results are written
+   where the submitted pointers point, so they should live until then.
+   Each pool thread has its own queue and idle ones steal from the others.
+   Calls keep the priority of the submitting thread. Without a pool, or while
+   it is being changed, the call is made in mtrlj_submit_* itself. */
+struct mtrlj_job;
+
+/* Starts `threads` pool threads, after finishing the jobs of the old pool
+   if there is one. 0 stops it, which is the default. */
+MTRLJ_CODE mtrlj_set_thread_pool(int threads);
+
+struct mtrlj_job *
+mtrlj_submit_latest_situation(struct mtrlj_district district,
+                              struct mtrlj_situation *situation);
+struct mtrlj_job *
+mtrlj_submit_five_days_forecast(struct mtrlj_district district,
+                                struct mtrlj_daily_forecast *forecasts);
+struct mtrlj_job *
+mtrlj_submit_hourly_forecasts(struct mtrlj_district district,
+                              struct mtrlj_hourly_forecast *forecasts,
+                              size_t capacity, size_t *size);
+
+MTRLJ_CODE mtrlj_wait(struct mtrlj_job *job);
+
+/* Transport settings and statistics, these are process wide. */
+
+/* Keeps raw MGM responses in `directory` (created if missing) and serves
+   requests from there while they are younger than `max_age` seconds. Older
+   ones are revalidated with MGM using their ETag/Last-Modified. NULL directory
+   disables the cache. Fails with MTRLJ_BUFFER_TOO_SMALL for a directory path
+   longer than 1006 bytes. */
+MTRLJ_CODE mtrlj_set_cache_dir(const char *directory, long max_age);
+
+/* Keeps responses younger than `max_age` seconds in memory too, using at most
+   `max_bytes` bytes. Every entry is charged for its bookkeeping, URL and
+   response, least recently used ones are dropped once it is full. It sits in
+   front of the disk cache and both can be used together. 0 bytes disables it,
+   which is the default. */
+MTRLJ_CODE mtrlj_set_memory_cache(size_t max_bytes, long max_age);
+
+/* Shares latest situations and forecasts between processes through the POSIX
+   shared memory segment `name` (e.g. "/meteoroloji"), which has room for
+   `capacity` records. Records younger than `max_age` seconds are used as is.
+   When one gets older, the first process asking for it refreshes it while the
+   others keep getting the old one. The first process opening the segment
+   decides its size. It stays around until shm_unlink(name). Older glibc wants
+   `-lrt` for it. */
+MTRLJ_CODE mtrlj_shared_cache_open(const char *name, size_t capacity,
+                                   long max_age);
+void mtrlj_shared_cache_close(void);
+
+/* Remembers for `ttl` seconds the stations (districts for latest situation
+   and five days forecast) MGM answered with 404 or with something
+   unparsable, they fail right away with the same code meanwhile. 0 disables
+   it, which is the default. */
+MTRLJ_CODE mtrlj_set_negative_cache(long ttl);
+
+/* Timeouts in milliseconds, 0 for none. `connect` and `transfer` are for
+   every transfer. `call` is for a whole library call including its retries,
+   e.g. all 6 requests of mtrlj_five_days_forecast or all of
+   mtrlj_catalog_load; requests are cut short or not made at all once it
+   passes. Defaults are 10 s, 30 s and none. */
+MTRLJ_CODE mtrlj_set_timeouts(long connect, long transfer, long call);
+
+/* Tries failed transfers (network errors, 429 and 5xx, all of them are GETs
+   so it is safe) again up to `max_retries` times. Before the n'th retry it
+   waits a random time up to `base_delay` * 2^n milliseconds, but not more
+   than `max_delay`. Default is no retries. */
+MTRLJ_CODE mtrlj_set_retries(int max_retries, long base_delay, long max_delay);
+
+/* Circuit breaker for every MGM endpoint (URL path). After `failures` failed
+   transfers in a row (network errors, 429 and 5xx, after retries) it opens
+   and requests to that endpoint fail right away, or are answered from disk
+   cache however old it is. After `open_time` milliseconds one request is let
+   through; the breaker closes if it succeeds and opens again if not. 0
+   failures disables it, which is the default. */
+MTRLJ_CODE mtrlj_set_circuit_breaker(int failures, long open_time);
+
+/* Hedging for latest situation and forecast requests. If one hasn't finished
+   by the `percentile`th (e.g. 95) percentile of their recent latencies, the
+   same request is sent again on another connection; the first response wins
+   and the other is cancelled. At most `budget` percent of requests are
+   hedged. 0 percentile disables it, which is the default. */
+MTRLJ_CODE mtrlj_set_hedging(double percentile, double budget);
+
+/* Token bucket for all transfers, at most `rate` per second on average and
+   `burst` at once. Transfers wait for their turn, unless the call timeout
+   would pass meanwhile. 0 rate disables it, which is the default. */
+MTRLJ_CODE mtrlj_set_rate_limit(double rate, double burst);
+
+typedef enum {
+    MTRLJ_PRIORITY_INTERACTIVE = 0,
+    MTRLJ_PRIORITY_BACKGROUND
+} MTRLJ_PRIORITY;
+
+/* Priority of the library calls made by the calling thread from now on.
+   Threads start interactive; the library's own refresher and subscription
+   threads are background. */
+void mtrlj_set_priority(MTRLJ_PRIORITY priority);
+
+/* At most `max` transfers run at once, `reserved` of them only for
+   interactive calls. Waiting interactive transfers go before any background
+   one. 0 max disables it, which is the default. */
+MTRLJ_CODE mtrlj_set_max_transfers(int max, int reserved);
+
+/* Batch calls (mtrlj_latest_situation_columns) fetch up to `max` districts
+   at the same time. How many exactly adapts to MGM: one more per round of
+   successes, half as many on failures or when latency doubles over the best
+   seen. 1 keeps them sequential, which is the default. Threads started for
+   it stay until mtrlj_shutdown, the call timeout is for the whole batch. */
+MTRLJ_CODE mtrlj_set_batch_concurrency(int max);
+
+struct mtrlj_stats {
+    unsigned long requests;        /* transfers made to MGM */
+    unsigned long rate_limited;    /* transfers that waited for a token */
+    unsigned long slot_waits;      /* transfers that waited for a free slot */
+    unsigned long hedges;          /* duplicate transfers sent */
+    unsigned long hedge_wins;      /* duplicates that answered first */
+    unsigned long retries;         /* transfers which were retries */
+    unsigned long timeouts;        /* transfers that timed out */
+    unsigned long deadline_hits;   /* requests given up for call timeout */
+    unsigned long breaker_trips;   /* times an endpoint's breaker opened */
+    unsigned long breaker_rejects; /* requests not made for an open breaker */
+    unsigned long failed_requests; /* transfers that didn't end with 200/304 */
+    unsigned long disk_hits;       /* answered from disk cache */
+    unsigned long disk_misses;     /* not in disk cache or too old */
+    unsigned long not_modified;    /* old disk cache entries MGM confirmed */
+    unsigned long stale_hits;      /* answered stale from disk cache */
+    unsigned long refreshes;       /* background refreshes done */
+
+    size_t memory_bytes;            /* bytes held by memory cache */
+    unsigned long memory_entries;   /* responses held by memory cache */
+    unsigned long memory_hits;      /* answered from memory cache */
+    unsigned long memory_misses;    /* not in memory cache or too old */
+    unsigned long memory_evictions; /* dropped because memory cache was full */
+    double memory_hit_ratio;        /* hits / (hits + misses), 0 if none */
+
+    unsigned long shared_hits;    /* answered from shared memory cache */
+    unsigned long shared_refresh; /* shared records this process refreshed */
+
+    unsigned long negative_hits; /* failed right away by negative cache */
+
+    double batch_window; /* districts a batch call may fetch at once */
+};
+
+/* Lets cache entries which are at most `max_stale` seconds older than the
+   cache max age to be returned right away. Then a library owned worker thread
+   refreshes them in background, check `age` field of the results to see how
+   old they are. 0 disables it, which is the default. */
+MTRLJ_CODE mtrlj_set_stale_while_revalidate(long max_stale);
+
+void mtrlj_get_stats(struct mtrlj_stats *stats);
+
+/* Stops library owned threads and frees transport settings, call it once you
+   are done with the library and its loops are freed. */
+void mtrlj_shutdown(void);
+
 /* Be responsible and free your memory! */
 void mtrlj_free_district(struct mtrlj_district district);
 void mtrlj_free_ndistrict(struct mtrlj_district *pdistrict, size_t size);
 void mtrlj_free_daily_forecasts(struct mtrlj_daily_forecast *pforecast);
 void mtrlj_free_hourly_forecasts(struct mtrlj_hourly_forecast *pforecast);
+void mtrlj_free_situation_columns(struct mtrlj_situation_columns *columns);
+void mtrlj_free_hourly_forecast_columns(
+    struct mtrlj_hourly_forecast_columns *columns);
+void mtrlj_free_catalog(struct mtrlj_catalog *catalog);
+void mtrlj_free_change_tracker(struct mtrlj_change_tracker *tracker);
+void mtrlj_free_poll_schedule(struct mtrlj_poll_schedule *schedule);
+void mtrlj_free_loop(struct mtrlj_loop *loop);
+void mtrlj_free_op(struct mtrlj_op *op);
 
 #endif
 
 #ifdef METEOROLOJI_IMPL
 
+/* for mkdir and friends, this is why meteoroloji.h should be included before
+   other headers in the implementation file. */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <curl/curl.h>
 #include <cJSON.h>
 
+#ifdef METEOROLOJI_EMBED_CATALOG
+#include "meteoroloji_catalog.h"
+#endif
+
+#if !defined(METEOROLOJI_NO_SIMD) && defined(__GNUC__)                         \
+    && (defined(__x86_64__) || defined(__i386__))
+#define MTRLJ_X86_SIMD
+#include <immintrin.h>
+#endif
+
 /* CURL HELPERS */
 
 struct mtrlj_curl_response {
     char *response;
     size_t size;
+    long status;
+    char etag[128];
+    char last_modified[64];
+    long age; /* seconds, if it came from the disk cache */
 };
 
+/* Process wide state of the transport, stats are guarded by the lock since
+   the refresher thread updates them too. */
+static struct {
+    char *cache_dir;
+    long cache_max_age;
+    long cache_max_stale;
+    struct mtrlj_stats stats;
+} mtrlj_transport;
+
+static pthread_mutex_t mtrlj_transport_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Guarded by the transport lock, read it through mtrlj_timing_copy. */
+static struct mtrlj_timing {
+    long connect, transfer, call; /* milliseconds */
+    int max_retries;
+    long base_delay, max_delay;
+    unsigned long seed;
+} mtrlj_timing = {10000, 30000, 0, 0, 100, 2000, 0};
+
+static struct mtrlj_timing mtrlj_timing_copy(void)
+{
+    struct mtrlj_timing timing;
+
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    timing = mtrlj_timing;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+
+    return timing;
+}
+
+static void mtrlj_count(unsigned long *counter)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    (*counter)++;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+}
+
+static double mtrlj_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void mtrlj_sleep_ms(long milliseconds)
+{
+    struct timespec duration;
+
+    duration.tv_sec = milliseconds / 1000;
+    duration.tv_nsec = (milliseconds % 1000) * 1000000L;
+    while (nanosleep(&duration, &duration) != 0)
+        ;
+}
+
 static size_t mtrlj_writer_callback(char *ptr, size_t size, size_t nmemb,
                                     void *cptr)
 {
@@ -232,686 +918,6692 @@ static size_t mtrlj_writer_callback(char *ptr, size_t size, size_t nmemb,
     return total;
 }
 
-int mtrlj_curl_get_params(const char *url, const char **params,
-                          size_t param_count, struct mtrlj_curl_response *mcp)
+/* Copies value of header `name` (lowercase, with colon) if `line` is it. */
+static void mtrlj_copy_header(const char *line, size_t length,
+                              const char *name, char *value, size_t capacity)
 {
-    CURL *curl;
-    CURLcode res;
-    CURLU *urlp;
-    CURLUcode uc;
-    long response_code = 0;
+    size_t name_length = strlen(name);
     size_t i;
 
-    urlp = curl_url();
-    uc = curl_url_set(urlp, CURLUPART_URL, url, 0);
-    for (i = 0; i < param_count; i++) {
-        uc = curl_url_set(urlp, CURLUPART_QUERY, params[i],
-                          CURLU_APPENDQUERY | CURLU_URLENCODE);
-    }
+    if (length < name_length)
+        return;
 
-    if (uc) {
-        curl_url_cleanup(urlp);
-        return 0;
+    for (i = 0; i < name_length; i++) {
+        if (tolower((unsigned char)line[i]) != name[i])
+            return;
     }
 
-    curl = curl_easy_init();
-    if (curl) {
-        struct curl_slist *hchunk = NULL;
-
-        hchunk = curl_slist_append(hchunk, "Origin: https://www.mgm.gov.tr");
-        curl_easy_setopt(curl, CURLOPT_CURLU, urlp);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hchunk);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, mtrlj_writer_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)mcp);
+    while (i < length && line[i] == ' ')
+        i++;
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n",
-                    curl_easy_strerror(res));
-        } else {
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-        }
+    length -= i;
+    while (length > 0 && (line[i + length - 1] == '\r'
+                          || line[i + length - 1] == '\n'))
+        length--;
 
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(hchunk);
-    }
-    curl_url_cleanup(urlp);
+    if (length >= capacity)
+        return; /* we don't want half of a validator */
 
-    return res == CURLE_OK && response_code == 200;
+    memcpy(value, line + i, length);
+    value[length] = 0;
 }
 
-int mtrlj_curl_get(const char *url, struct mtrlj_curl_response *mcp)
+static size_t mtrlj_header_callback(char *buffer, size_t size, size_t nitems,
+                                    void *cptr)
 {
-    return mtrlj_curl_get_params(url, NULL, 0, mcp);
+    struct mtrlj_curl_response *mcp = (struct mtrlj_curl_response *)cptr;
+    size_t total = size * nitems;
+
+    mtrlj_copy_header(buffer, total, "etag:", mcp->etag, sizeof(mcp->etag));
+    mtrlj_copy_header(buffer, total, "last-modified:", mcp->last_modified,
+                      sizeof(mcp->last_modified));
+
+    return total;
 }
 
-/* District parsing helper */
+/* Disk cache. An entry is a file named after the hash of its URL:
+   ```
+   url <url>
+   fetched <unix time>
+   etag <etag>
+   last-modified <http date>
+   data-time <veriZamani in the response>
 
-MTRLJ_CODE mtrlj_json_parse_district(const cJSON *district_json,
-                                     struct mtrlj_district *district)
-{
-    size_t name_size;
-    size_t city_name_size;
+   <response>
+   ```
+*/
 
-    cJSON *id = cJSON_GetObjectItem(district_json, "merkezId");
-    cJSON *height = cJSON_GetObjectItem(district_json, "yukseklik");
-    cJSON *daily_forecast_station =
-        cJSON_GetObjectItem(district_json, "gunlukTahminIstNo");
-    cJSON *hourly_forecast_station =
-        cJSON_GetObjectItem(district_json, "saatlikTahminIstNo");
-    cJSON *longitude = cJSON_GetObjectItem(district_json, "boylam");
-    cJSON *latitude = cJSON_GetObjectItem(district_json, "enlem");
-    cJSON *name = cJSON_GetObjectItem(district_json, "ilce");
-    cJSON *city_name = cJSON_GetObjectItem(district_json, "il");
-    cJSON *city_plate_code = cJSON_GetObjectItem(district_json, "ilPlaka");
+/* the directory, a slash and two hashes */
+#define MTRLJ_CACHE_PATH_MAX 1024
+#define MTRLJ_CACHE_NAME_LENGTH 17
 
-    if (!cJSON_IsNumber(id) || !cJSON_IsNumber(height)
-        || !cJSON_IsNumber(longitude) || !cJSON_IsNumber(latitude)
-        || !cJSON_IsNumber(city_plate_code) || !cJSON_IsString(name)
-        || !cJSON_IsString(city_name) || (name->valuestring == NULL)
-        || (city_name->valuestring == NULL)) {
-        return MTRLJ_JSON_PARSING_FAILED;
+struct mtrlj_cache_entry {
+    long fetched;
+    char etag[128];
+    char last_modified[64];
+    char data_time[32];
+    char *body;
+    size_t size;
+};
+
+/* Returns 0 if the cache is off. The directory is copied under the lock,
+   another thread may change it meanwhile. */
+static int mtrlj_cache_path(const char *url, char *path)
+{
+    unsigned long h1 = 2166136261UL, h2 = 5381;
+    const unsigned char *p;
+    int on;
+
+    for (p = (const unsigned char *)url; *p; p++) {
+        h1 = ((h1 ^ *p) * 16777619UL) & 0xffffffffUL;
+        h2 = (h2 * 33 + *p) & 0xffffffffUL;
     }
 
-    district->id = id->valueint;
-    district->height = height->valueint;
-    if (cJSON_IsNumber(daily_forecast_station))
-        district->daily_forecast_station = daily_forecast_station->valueint;
-    if (cJSON_IsNumber(hourly_forecast_station))
-        district->hourly_forecast_station = hourly_forecast_station->valueint;
-    district->longitude = longitude->valuedouble;
-    district->latitude = latitude->valuedouble;
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    on = mtrlj_transport.cache_dir != NULL;
+    if (on)
+        sprintf(path, "%s/%08lx%08lx", mtrlj_transport.cache_dir, h1, h2);
+    pthread_mutex_unlock(&mtrlj_transport_lock);
 
-    name_size = (strlen(name->valuestring) + 1) * sizeof(char);
-    district->name = malloc(name_size);
-    memcpy(district->name, name->valuestring, name_size);
+    return on;
+}
 
-    city_name_size = (strlen(city_name->valuestring) + 1) * sizeof(char);
-    district->city_name = malloc(city_name_size);
-    memcpy(district->city_name, city_name->valuestring, city_name_size);
+/* Reads the line starting with `key ` into `value`, returns the next line. */
+static char *mtrlj_cache_line(char *line, const char *key, char *value,
+                              size_t capacity)
+{
+    char *end;
+    size_t key_length = strlen(key);
+    size_t length;
 
-    district->city_plate_code = city_plate_code->valueint;
+    if (line == NULL || (end = strchr(line, '\n')) == NULL
+        || strncmp(line, key, key_length) != 0 || line[key_length] != ' ')
+        return NULL;
 
-    return MTRLJ_OK;
+    length = end - (line + key_length + 1);
+    if (length >= capacity)
+        length = capacity - 1;
+    memcpy(value, line + key_length + 1, length);
+    value[length] = 0;
+
+    return end + 1;
 }
 
-/* Condition from 1-3 letter codes */
-MTRLJ_WEATHER_CONDITION mtrlj_condition_from_code(const char *code)
+static int mtrlj_cache_read(const char *url, struct mtrlj_cache_entry *entry)
 {
-    /* i am just using bitwise operations to encode characters to shorten this
-       function */
-    size_t len;
-    uint32_t condition = 0;
+    char path[MTRLJ_CACHE_PATH_MAX];
+    char fetched[32];
+    char *content, *line;
+    FILE *file;
+    long size;
+    size_t url_length = strlen(url);
+
+    if (!mtrlj_cache_path(url, path))
+        return 0;
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return 0;
 
-    len = strlen(code);
-    if (len < 1 || len > 3)
-        return MTRLJ_WEATHER_INVALID;
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0) {
+        fclose(file);
+        return 0;
+    }
+    rewind(file);
 
-    condition |= code[0] << 16; /* 0x00XX0000 */
+    content = malloc(size + 1);
+    if (fread(content, 1, size, file) != (size_t)size) {
+        free(content);
+        fclose(file);
+        return 0;
+    }
+    content[size] = 0;
+    fclose(file);
+
+    /* hashes can collide, make sure this is the same URL */
+    line = content;
+    if (strncmp(line, "url ", 4) != 0 || strncmp(line + 4, url, url_length) != 0
+        || line[4 + url_length] != '\n') {
+        free(content);
+        return 0;
+    }
+    line += 4 + url_length + 1;
+
+    line = mtrlj_cache_line(line, "fetched", fetched, sizeof(fetched));
+    line = mtrlj_cache_line(line, "etag", entry->etag, sizeof(entry->etag));
+    line = mtrlj_cache_line(line, "last-modified", entry->last_modified,
+                            sizeof(entry->last_modified));
+    line = mtrlj_cache_line(line, "data-time", entry->data_time,
+                            sizeof(entry->data_time));
+    if (line == NULL || *line != '\n') {
+        free(content);
+        return 0;
+    }
+    line++;
 
-    if (len > 1)
-        condition |= code[1] << 8; /* 0x00xxXX00 */
+    entry->fetched = atol(fetched);
+    entry->size = size - (line - content);
+    entry->body = malloc(entry->size + 1);
+    memcpy(entry->body, line, entry->size + 1);
 
-    if (len > 2)
-        condition |= code[2]; /* 0x00xxxxXX */
+    free(content);
+    return 1;
+}
 
-    /* This condition has 2 codes(`KYK` and `YKY`) */
-    if (condition == 0x00594b59)
-        return MTRLJ_WEATHER_HEAVY_SNOWY;
+static void mtrlj_cache_write(const char *url, long fetched,
+                              const struct mtrlj_curl_response *mcp)
+{
+    char path[MTRLJ_CACHE_PATH_MAX];
+    char temp_path[MTRLJ_CACHE_PATH_MAX + 16];
+    char data_time[32] = "";
+    const char *found;
+    FILE *file;
+
+    if (!mtrlj_cache_path(url, path))
+        return;
+    sprintf(temp_path, "%s.tmp", path);
+
+    /* MGM tells when the data was produced, handy to keep next to it */
+    found = strstr(mcp->response, "\"veriZamani\":\"");
+    if (found) {
+        found += strlen("\"veriZamani\":\"");
+        sscanf(found, "%31[^\"]", data_time);
+    }
 
-    return (MTRLJ_WEATHER_CONDITION)condition;
+    file = fopen(temp_path, "wb");
+    if (file == NULL)
+        return;
+
+    fprintf(file, "url %s\nfetched %ld\netag %s\nlast-modified %s\n"
+                  "data-time %s\n\n",
+            url, fetched, mcp->etag, mcp->last_modified, data_time);
+    fwrite(mcp->response, 1, mcp->size, file);
+
+    /* rename is atomic, readers never see half of an entry */
+    if (fclose(file) != 0 || rename(temp_path, path) != 0)
+        remove(temp_path);
 }
 
-/* Parsing time */
-struct mtrlj_time mtrlj_parse_iso8601_time(const char *str)
+/* Memory cache. Entries are in a chained hash table for lookup and in a
+   doubly linked list for recency, head being the most recently used one. All
+   of it is guarded by the transport lock. */
+
+struct mtrlj_memory_entry {
+    struct mtrlj_memory_entry *prev, *next;
+    struct mtrlj_memory_entry *chain;
+    unsigned long hash;
+    long fetched;
+    size_t cost;
+    size_t size;
+    char *url;
+    char *body;
+};
+
+static struct {
+    struct mtrlj_memory_entry **buckets;
+    size_t bucket_count;
+    struct mtrlj_memory_entry *head, *tail;
+    size_t max_bytes;
+    long max_age;
+} mtrlj_memory;
+
+/* Copies the disk cache settings and the memory cache size, returns 0 if the
+   disk cache is off. */
+static int mtrlj_cache_settings(long *max_age, long *max_stale,
+                                size_t *memory_bytes)
 {
-    char *temp;
-    char *after_t;
-    char *part;
-    struct mtrlj_time time;
+    int on;
 
-    temp = calloc(strlen(str) + 1, sizeof(char));
-    strcpy(temp, str);
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    on = mtrlj_transport.cache_dir != NULL;
+    *max_age = mtrlj_transport.cache_max_age;
+    *max_stale = mtrlj_transport.cache_max_stale;
+    *memory_bytes = mtrlj_memory.max_bytes;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
 
-    after_t = strchr(temp, 'T') + 1;
+    return on;
+}
 
-    part = strtok(temp, "-");
-    time.year = atoi(part);
+static unsigned long mtrlj_url_hash(const char *url)
+{
+    unsigned long hash = 2166136261UL;
 
-    part = strtok(NULL, "-");
-    time.month = atoi(part);
+    for (; *url; url++)
+        hash = ((hash ^ (unsigned char)*url) * 16777619UL) & 0xffffffffUL;
 
-    part = strtok(NULL, "-");
-    time.day = atoi(part);
+    return hash;
+}
 
-    part = strtok(after_t, ":");
-    time.hour = atoi(part); /* Türkiye time. */
+static struct mtrlj_memory_entry **mtrlj_memory_slot(const char *url,
+                                                     unsigned long hash)
+{
+    struct mtrlj_memory_entry **slot;
 
-    part = strtok(NULL, ":");
-    time.minute = atoi(part);
+    slot = &mtrlj_memory.buckets[hash & (mtrlj_memory.bucket_count - 1)];
+    while (*slot && ((*slot)->hash != hash || strcmp((*slot)->url, url) != 0))
+        slot = &(*slot)->chain;
 
-    part = strtok(NULL, ":");
-    part = strtok(part, ".");
-    time.second = atoi(part);
+    return slot;
+}
 
-    free(temp);
+static void mtrlj_memory_unlink(struct mtrlj_memory_entry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        mtrlj_memory.head = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        mtrlj_memory.tail = entry->prev;
+}
 
-    return time;
+static void mtrlj_memory_push_front(struct mtrlj_memory_entry *entry)
+{
+    entry->prev = NULL;
+    entry->next = mtrlj_memory.head;
+    if (mtrlj_memory.head)
+        mtrlj_memory.head->prev = entry;
+    else
+        mtrlj_memory.tail = entry;
+    mtrlj_memory.head = entry;
 }
 
-/* Getting past min and max values for a daily forecast */
-MTRLJ_CODE mtrlj_get_past_values(int id, struct mtrlj_daily_forecast *forecast)
+static void mtrlj_memory_remove(struct mtrlj_memory_entry *entry)
 {
-    const char *PAST_VALUES_ENDPOINT =
-        "https://servis.mgm.gov.tr/web/ucdegerler";
-    char *url_parameters[3];
-    MTRLJ_CODE return_code = MTRLJ_OK;
-    struct mtrlj_curl_response mcp = {0};
-    cJSON *past_json = NULL;
+    struct mtrlj_memory_entry **slot;
 
-    url_parameters[0] = calloc(128, sizeof(char));
-    url_parameters[1] = calloc(128, sizeof(char));
-    url_parameters[2] = calloc(128, sizeof(char));
-    sprintf(url_parameters[0], "merkezid=%d", id);
-    sprintf(url_parameters[1], "ay=%d", forecast->time.month);
-    sprintf(url_parameters[2], "gun=%d", forecast->time.day);
+    slot = mtrlj_memory_slot(entry->url, entry->hash);
+    *slot = entry->chain;
+    mtrlj_memory_unlink(entry);
 
-    if (!mtrlj_curl_get_params(PAST_VALUES_ENDPOINT,
-                               (const char **)url_parameters, 3, &mcp)) {
-        return_code = MTRLJ_REQUEST_FAILED;
-        goto end;
-    }
+    mtrlj_transport.stats.memory_bytes -= entry->cost;
+    mtrlj_transport.stats.memory_entries--;
 
-    past_json = cJSON_Parse(mcp.response);
-    if (past_json == NULL || !cJSON_IsArray(past_json)
-        || cJSON_GetArraySize(past_json) != 1) {
-        return_code = MTRLJ_JSON_PARSING_FAILED;
-        goto end;
+    free(entry->url);
+    free(entry->body);
+    free(entry);
+}
+
+static void mtrlj_memory_fit(size_t max_bytes)
+{
+    while (mtrlj_memory.tail
+           && mtrlj_transport.stats.memory_bytes > max_bytes) {
+        mtrlj_memory_remove(mtrlj_memory.tail);
+        mtrlj_transport.stats.memory_evictions++;
     }
+}
 
-    {
-        cJSON *json = cJSON_GetArrayItem(past_json, 0);
-        cJSON *past_peak_temperature_min = cJSON_GetObjectItem(json, "min");
-        cJSON *past_peak_temperature_max = cJSON_GetObjectItem(json, "max");
-        cJSON *past_average_temperature_min =
-            cJSON_GetObjectItem(json, "minOrt");
-        cJSON *past_average_temperature_max =
-            cJSON_GetObjectItem(json, "maxOrt");
+static void mtrlj_memory_grow(void)
+{
+    struct mtrlj_memory_entry **old = mtrlj_memory.buckets;
+    size_t old_count = mtrlj_memory.bucket_count;
+    size_t i;
 
-        if (!cJSON_IsNumber(past_peak_temperature_min)
-            || !cJSON_IsNumber(past_peak_temperature_max)
-            || !cJSON_IsNumber(past_average_temperature_min)
-            || !cJSON_IsNumber(past_average_temperature_max)) {
-            return_code = MTRLJ_JSON_PARSING_FAILED;
-            goto end;
-        }
+    mtrlj_memory.bucket_count = old_count ? old_count * 2 : 64;
+    mtrlj_memory.buckets = calloc(mtrlj_memory.bucket_count,
+                                  sizeof(struct mtrlj_memory_entry *));
 
-        forecast->past_peak_temperature_min =
-            past_peak_temperature_min->valuedouble;
-        forecast->past_peak_temperature_max =
-            past_peak_temperature_max->valuedouble;
-        forecast->past_average_temperature_min =
-            past_average_temperature_min->valuedouble;
-        forecast->past_average_temperature_max =
-            past_average_temperature_max->valuedouble;
+    for (i = 0; i < old_count; i++) {
+        struct mtrlj_memory_entry *entry = old[i], *chain;
+
+        for (; entry; entry = chain) {
+            struct mtrlj_memory_entry **slot =
+                &mtrlj_memory.buckets[entry->hash
+                                      & (mtrlj_memory.bucket_count - 1)];
+            chain = entry->chain;
+            entry->chain = *slot;
+            *slot = entry;
+        }
     }
 
-end:
-    free(url_parameters[0]);
-    free(url_parameters[1]);
-    free(url_parameters[2]);
-    cJSON_Delete(past_json);
-    free(mcp.response);
-    return return_code;
+    free(old);
 }
 
-/* Exposed functions */
-
-MTRLJ_CODE mtrlj_get_cities(struct mtrlj_district **cities, size_t *size)
+/* Copies a fresh response into `mcp` if there is one. */
+static int mtrlj_memory_get(const char *url, struct mtrlj_curl_response *mcp)
 {
-    const char *CITIES_ENDPOINT =
-        "https://servis.mgm.gov.tr/web/merkezler/iller";
-    MTRLJ_CODE return_code = MTRLJ_OK;
-    struct mtrlj_curl_response mcp = {0};
-    cJSON *cities_json = NULL;
-    const cJSON *city_json = NULL;
-    size_t i;
+    struct mtrlj_memory_entry *entry;
+    long age;
+    int hit = 0;
 
-    if (!mtrlj_curl_get(CITIES_ENDPOINT, &mcp)) {
-        return_code = MTRLJ_REQUEST_FAILED;
-        goto end;
-    }
+    pthread_mutex_lock(&mtrlj_transport_lock);
 
-    cities_json = cJSON_Parse(mcp.response);
-    if (cities_json == NULL || !cJSON_IsArray(cities_json)) {
-        return_code = MTRLJ_JSON_PARSING_FAILED;
+    if (mtrlj_memory.max_bytes == 0)
         goto end;
-    }
 
-    *size = cJSON_GetArraySize(cities_json);
-    *cities = calloc(*size, sizeof(struct mtrlj_district));
+    entry = mtrlj_memory.bucket_count
+                ? *mtrlj_memory_slot(url, mtrlj_url_hash(url))
+                : NULL;
+    age = entry ? (long)time(NULL) - entry->fetched : 0;
 
-    i = 0;
-    cJSON_ArrayForEach(city_json, cities_json)
-    {
-        MTRLJ_CODE res = mtrlj_json_parse_district(city_json, *cities + i);
+    if (entry == NULL || age >= mtrlj_memory.max_age) {
+        mtrlj_transport.stats.memory_misses++;
+        goto end;
+    }
 
-        if (res != MTRLJ_OK) {
-            return_code = res;
-            goto end;
-        }
+    mtrlj_memory_unlink(entry);
+    mtrlj_memory_push_front(entry);
+    mtrlj_transport.stats.memory_hits++;
 
-        i++;
-    }
+    mcp->response = malloc(entry->size + 1);
+    memcpy(mcp->response, entry->body, entry->size + 1);
+    mcp->size = entry->size;
+    mcp->status = 200;
+    mcp->age = age > 0 ? age : 0;
+    hit = 1;
 
 end:
-    cJSON_Delete(cities_json);
-    free(mcp.response);
-    return return_code;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return hit;
 }
 
-MTRLJ_CODE mtrlj_get_district(struct mtrlj_district *district,
-                              const char *city_name, const char *district_name)
+static void mtrlj_memory_put(const char *url, long fetched,
+                             const struct mtrlj_curl_response *mcp)
+{
+    struct mtrlj_memory_entry *entry, **slot;
+    size_t url_size = strlen(url) + 1;
+    size_t cost = sizeof(struct mtrlj_memory_entry)
+                  + sizeof(struct mtrlj_memory_entry *) + url_size
+                  + mcp->size + 1;
+
+    pthread_mutex_lock(&mtrlj_transport_lock);
+
+    if (cost > mtrlj_memory.max_bytes)
+        goto end;
+
+    if (mtrlj_memory.bucket_count <= mtrlj_transport.stats.memory_entries)
+        mtrlj_memory_grow();
+
+    slot = mtrlj_memory_slot(url, mtrlj_url_hash(url));
+    if (*slot)
+        mtrlj_memory_remove(*slot);
+
+    /* make room first, so the new entry isn't the one evicted */
+    mtrlj_memory_fit(mtrlj_memory.max_bytes - cost);
+
+    entry = malloc(sizeof(struct mtrlj_memory_entry));
+    entry->hash = mtrlj_url_hash(url);
+    entry->fetched = fetched;
+    entry->cost = cost;
+    entry->size = mcp->size;
+    entry->url = malloc(url_size);
+    memcpy(entry->url, url, url_size);
+    entry->body = malloc(mcp->size + 1);
+    memcpy(entry->body, mcp->response, mcp->size);
+    entry->body[mcp->size] = 0;
+
+    slot = mtrlj_memory_slot(url, entry->hash);
+    entry->chain = NULL;
+    *slot = entry;
+    mtrlj_memory_push_front(entry);
+
+    mtrlj_transport.stats.memory_bytes += cost;
+    mtrlj_transport.stats.memory_entries++;
+
+end:
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+}
+
+MTRLJ_CODE mtrlj_set_memory_cache(size_t max_bytes, long max_age)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+
+    mtrlj_memory.max_bytes = max_bytes;
+    mtrlj_memory.max_age = max_age;
+    mtrlj_memory_fit(max_bytes);
+
+    if (max_bytes == 0) {
+        free(mtrlj_memory.buckets);
+        mtrlj_memory.buckets = NULL;
+        mtrlj_memory.bucket_count = 0;
+    }
+
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return MTRLJ_OK;
+}
+
+MTRLJ_CODE mtrlj_set_cache_dir(const char *directory, long max_age)
+{
+    char *copy = NULL;
+
+    if (directory) {
+        if (strlen(directory) + MTRLJ_CACHE_NAME_LENGTH
+            >= MTRLJ_CACHE_PATH_MAX)
+            return MTRLJ_BUFFER_TOO_SMALL;
+
+        mkdir(directory, 0755); /* it is ok if it exists */
+        copy = malloc(strlen(directory) + 1);
+        strcpy(copy, directory);
+    }
+
+    /* other threads may be reading it, see mtrlj_cache_path */
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    free(mtrlj_transport.cache_dir);
+    mtrlj_transport.cache_dir = copy;
+    mtrlj_transport.cache_max_age = max_age;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+
+    return MTRLJ_OK;
+}
+
+MTRLJ_CODE mtrlj_set_stale_while_revalidate(long max_stale)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    mtrlj_transport.cache_max_stale = max_stale;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return MTRLJ_OK;
+}
+
+void mtrlj_get_stats(struct mtrlj_stats *stats)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    *stats = mtrlj_transport.stats;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+
+    stats->memory_hit_ratio = 0;
+    if (stats->memory_hits + stats->memory_misses > 0)
+        stats->memory_hit_ratio =
+            (double)stats->memory_hits
+            / (stats->memory_hits + stats->memory_misses);
+
+    if (stats->batch_window < 1) /* no batch fetched yet */
+        stats->batch_window = 1;
+}
+
+MTRLJ_CODE mtrlj_set_timeouts(long connect, long transfer, long call)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    mtrlj_timing.connect = connect;
+    mtrlj_timing.transfer = transfer;
+    mtrlj_timing.call = call;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return MTRLJ_OK;
+}
+
+MTRLJ_CODE mtrlj_set_retries(int max_retries, long base_delay, long max_delay)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    mtrlj_timing.max_retries = max_retries;
+    mtrlj_timing.base_delay = base_delay;
+    mtrlj_timing.max_delay = max_delay;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return MTRLJ_OK;
+}
+
+/* Deadline of the library call a thread is in. Calls nest (e.g. five days
+   forecast calls mtrlj_curl_get_params), the outermost one sets it. */
+
+struct mtrlj_call {
+    int depth;
+    double deadline; /* 0 if none */
+    MTRLJ_PRIORITY priority;
+    double transfer_time; /* seconds spent in transfers, for batches */
+};
+
+static pthread_key_t mtrlj_call_key;
+static pthread_once_t mtrlj_call_once = PTHREAD_ONCE_INIT;
+
+static void mtrlj_call_key_create(void)
+{
+    pthread_key_create(&mtrlj_call_key, free);
+}
+
+static struct mtrlj_call *mtrlj_call_state(void)
+{
+    struct mtrlj_call *call;
+
+    pthread_once(&mtrlj_call_once, mtrlj_call_key_create);
+    call = pthread_getspecific(mtrlj_call_key);
+    if (call == NULL) {
+        call = calloc(1, sizeof(struct mtrlj_call));
+        pthread_setspecific(mtrlj_call_key, call);
+    }
+
+    return call;
+}
+
+static void mtrlj_call_begin(void)
+{
+    struct mtrlj_call *call = mtrlj_call_state();
+    long limit;
+
+    if (call->depth++ == 0) {
+        limit = mtrlj_timing_copy().call;
+        call->deadline = limit > 0 ? mtrlj_now() + limit / 1e3 : 0;
+    }
+}
+
+static void mtrlj_call_end(void)
+{
+    mtrlj_call_state()->depth--;
+}
+
+void mtrlj_set_priority(MTRLJ_PRIORITY priority)
+{
+    mtrlj_call_state()->priority = priority;
+}
+
+/* Milliseconds left for the current call, -1 if there is no limit. */
+static long mtrlj_call_remaining(void)
+{
+    struct mtrlj_call *call = mtrlj_call_state();
+    double left;
+
+    if (call->depth == 0 || call->deadline == 0)
+        return -1;
+
+    left = (call->deadline - mtrlj_now()) * 1e3;
+    return left > 0 ? (long)left : 0;
+}
+
+/* Random delay before the retry number `attempt` (starting from 0). */
+static long mtrlj_backoff(int attempt)
+{
+    long limit, max_delay;
+    unsigned long random;
+
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    limit = mtrlj_timing.base_delay;
+    max_delay = mtrlj_timing.max_delay;
+    while (attempt-- > 0 && limit < max_delay)
+        limit *= 2;
+    if (limit > max_delay)
+        limit = max_delay;
+    if (limit <= 0) {
+        pthread_mutex_unlock(&mtrlj_transport_lock);
+        return 0;
+    }
+
+    if (mtrlj_timing.seed == 0)
+        mtrlj_timing.seed = (unsigned long)time(NULL) | 1;
+    /* xorshift, good enough for jitter */
+    mtrlj_timing.seed ^= (mtrlj_timing.seed << 13) & 0xffffffffUL;
+    mtrlj_timing.seed ^= mtrlj_timing.seed >> 17;
+    mtrlj_timing.seed ^= (mtrlj_timing.seed << 5) & 0xffffffffUL;
+    random = mtrlj_timing.seed;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+
+    return (long)(random % (unsigned long)(limit + 1));
+}
+
+/* Rate limiting. Tokens may go negative, that is tokens reserved by the
+   transfers waiting for them, so they are served in order. */
+
+static struct {
+    double rate, burst;
+    double tokens, last;
+} mtrlj_bucket;
+
+MTRLJ_CODE mtrlj_set_rate_limit(double rate, double burst)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    mtrlj_bucket.rate = rate;
+    mtrlj_bucket.burst = burst < 1 ? 1 : burst;
+    mtrlj_bucket.tokens = mtrlj_bucket.burst;
+    mtrlj_bucket.last = mtrlj_now();
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return MTRLJ_OK;
+}
+
+/* Waits for a token, returns 0 if it can't be had before the deadline. */
+static int mtrlj_rate_acquire(void)
+{
+    long remaining = mtrlj_call_remaining();
+    double now, wait = 0;
+    int ok = 1;
+
+    pthread_mutex_lock(&mtrlj_transport_lock);
+
+    if (mtrlj_bucket.rate > 0) {
+        now = mtrlj_now();
+        mtrlj_bucket.tokens += (now - mtrlj_bucket.last) * mtrlj_bucket.rate;
+        if (mtrlj_bucket.tokens > mtrlj_bucket.burst)
+            mtrlj_bucket.tokens = mtrlj_bucket.burst;
+        mtrlj_bucket.last = now;
+
+        if (mtrlj_bucket.tokens < 1)
+            wait = (1 - mtrlj_bucket.tokens) / mtrlj_bucket.rate;
+
+        if (remaining >= 0 && wait * 1e3 >= remaining) {
+            ok = 0;
+        } else {
+            mtrlj_bucket.tokens -= 1;
+            if (wait > 0)
+                mtrlj_transport.stats.rate_limited++;
+        }
+    }
+
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+
+    if (ok && wait > 0)
+        mtrlj_sleep_ms((long)(wait * 1e3) + 1);
+    return ok;
+}
+
+/* Transfer slots. Background transfers leave the reserved slots and the
+   ones interactive transfers are waiting for alone. */
+
+static struct {
+    int max, reserved;
+    int active;
+    int interactive_waiting;
+} mtrlj_slots;
+
+static pthread_mutex_t mtrlj_slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mtrlj_slots_free = PTHREAD_COND_INITIALIZER;
+
+MTRLJ_CODE mtrlj_set_max_transfers(int max, int reserved)
+{
+    pthread_mutex_lock(&mtrlj_slots_lock);
+    mtrlj_slots.max = max > 0 ? max : 0;
+    /* background needs at least one */
+    mtrlj_slots.reserved = reserved < 0 ? 0
+                           : reserved >= max ? (max > 0 ? max - 1 : 0)
+                                             : reserved;
+    pthread_cond_broadcast(&mtrlj_slots_free);
+    pthread_mutex_unlock(&mtrlj_slots_lock);
+    return MTRLJ_OK;
+}
+
+static int mtrlj_slot_usable(int interactive)
+{
+    if (mtrlj_slots.max == 0)
+        return 1;
+    if (interactive)
+        return mtrlj_slots.active < mtrlj_slots.max;
+    return mtrlj_slots.interactive_waiting == 0
+           && mtrlj_slots.active < mtrlj_slots.max - mtrlj_slots.reserved;
+}
+
+/* Waits for a slot, returns 0 if there is none before the deadline. */
+static int mtrlj_slot_acquire(void)
+{
+    int interactive =
+        mtrlj_call_state()->priority == MTRLJ_PRIORITY_INTERACTIVE;
+    long remaining = mtrlj_call_remaining();
+    struct timespec until;
+    int ok = 1;
+
+    if (remaining > 0) {
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += remaining / 1000;
+        until.tv_nsec += (remaining % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&mtrlj_slots_lock);
+
+    if (!mtrlj_slot_usable(interactive)) {
+        mtrlj_count(&mtrlj_transport.stats.slot_waits);
+        mtrlj_slots.interactive_waiting += interactive;
+        while (!mtrlj_slot_usable(interactive) && ok) {
+            if (remaining < 0)
+                pthread_cond_wait(&mtrlj_slots_free, &mtrlj_slots_lock);
+            else if (remaining == 0)
+                ok = 0; /* the deadline has passed, `until` isn't set */
+            else if (pthread_cond_timedwait(&mtrlj_slots_free,
+                                            &mtrlj_slots_lock, &until)
+                     != 0)
+                ok = mtrlj_slot_usable(interactive);
+        }
+        mtrlj_slots.interactive_waiting -= interactive;
+    }
+    if (ok)
+        mtrlj_slots.active++;
+
+    /* background ones may have been waiting for us to stop waiting */
+    pthread_cond_broadcast(&mtrlj_slots_free);
+    pthread_mutex_unlock(&mtrlj_slots_lock);
+    return ok;
+}
+
+static void mtrlj_slot_release(void)
+{
+    pthread_mutex_lock(&mtrlj_slots_lock);
+    mtrlj_slots.active--;
+    pthread_cond_broadcast(&mtrlj_slots_free);
+    pthread_mutex_unlock(&mtrlj_slots_lock);
+}
+
+/* Hedging. Latencies of successful hedgeable requests are kept in a ring,
+   its percentile tells when a request is late. */
+
+#define MTRLJ_LATENCY_SAMPLES 128
+#define MTRLJ_LATENCY_MIN_SAMPLES 16
+
+static struct {
+    double percentile, budget;
+    double samples[MTRLJ_LATENCY_SAMPLES]; /* milliseconds */
+    size_t count, next;
+} mtrlj_hedging;
+
+MTRLJ_CODE mtrlj_set_hedging(double percentile, double budget)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    mtrlj_hedging.percentile = percentile;
+    mtrlj_hedging.budget = budget;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return MTRLJ_OK;
+}
+
+static int mtrlj_compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int mtrlj_hedgeable(CURLU *urlp)
+{
+    char *path = NULL;
+    int hedgeable;
+
+    if (curl_url_get(urlp, CURLUPART_PATH, &path, 0) != CURLUE_OK)
+        return 0;
+
+    hedgeable = strstr(path, "/sondurumlar") || strstr(path, "/tahminler");
+    curl_free(path);
+    return hedgeable;
+}
+
+static void mtrlj_latency_record(double milliseconds)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    mtrlj_hedging.samples[mtrlj_hedging.next] = milliseconds;
+    mtrlj_hedging.next = (mtrlj_hedging.next + 1) % MTRLJ_LATENCY_SAMPLES;
+    if (mtrlj_hedging.count < MTRLJ_LATENCY_SAMPLES)
+        mtrlj_hedging.count++;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+}
+
+/* Milliseconds to wait before hedging, -1 if it shouldn't be hedged. */
+static long mtrlj_hedge_delay(void)
+{
+    double samples[MTRLJ_LATENCY_SAMPLES];
+    size_t count, index;
+    long delay = -1;
+
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    count = mtrlj_hedging.count;
+    if (mtrlj_hedging.percentile > 0 && count >= MTRLJ_LATENCY_MIN_SAMPLES
+        && (mtrlj_transport.stats.hedges + 1) * 100.0
+               <= mtrlj_hedging.budget * (mtrlj_transport.stats.requests + 1)) {
+        memcpy(samples, mtrlj_hedging.samples, count * sizeof(double));
+        qsort(samples, count, sizeof(double), mtrlj_compare_doubles);
+        index = (size_t)(mtrlj_hedging.percentile / 100 * (count - 1));
+        delay = (long)samples[index < count ? index : count - 1];
+    }
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+
+    return delay;
+}
+
+/* Conditional if we have a `cached` copy. */
+static struct curl_slist *
+mtrlj_request_headers(const struct mtrlj_cache_entry *cached)
+{
+    struct curl_slist *hchunk = NULL;
+    char header[192];
+
+    hchunk = curl_slist_append(hchunk, "Origin: https://www.mgm.gov.tr");
+    if (cached && cached->etag[0]) {
+        sprintf(header, "If-None-Match: %s", cached->etag);
+        hchunk = curl_slist_append(hchunk, header);
+    }
+    if (cached && cached->last_modified[0]) {
+        sprintf(header, "If-Modified-Since: %s", cached->last_modified);
+        hchunk = curl_slist_append(hchunk, header);
+    }
+
+    return hchunk;
+}
+
+static CURL *mtrlj_curl_easy(CURLU *urlp, struct curl_slist *headers,
+                             long transfer, struct mtrlj_curl_response *mcp)
+{
+    CURL *curl = curl_easy_init();
+    long connect = mtrlj_timing_copy().connect;
+
+    if (!curl)
+        return NULL;
+
+    curl_easy_setopt(curl, CURLOPT_CURLU, urlp);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, mtrlj_writer_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)mcp);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, mtrlj_header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)mcp);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, connect);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, transfer);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    return curl;
+}
+
+/* Runs `curl` and a duplicate of it started after `delay` milliseconds, the
+   first one finishing successfully wins. Its result ends up in `mcp`. */
+static CURLcode mtrlj_curl_hedged(CURL *curl, CURLU *urlp,
+                                  struct curl_slist *headers, long transfer,
+                                  long delay, struct mtrlj_curl_response *mcp)
+{
+    CURLM *multi = curl_multi_init();
+    CURLU *hedge_urlp = NULL;
+    CURL *hedge = NULL, *winner = NULL;
+    struct mtrlj_curl_response hedge_mcp = {0};
+    CURLcode res = CURLE_FAILED_INIT;
+    double start = mtrlj_now();
+    int running, active = 1;
+    int hedged = 0; /* tried, even if the hedge couldn't be made */
+
+    curl_multi_add_handle(multi, curl);
+
+    while (winner == NULL && active > 0) {
+        CURLMsg *msg;
+        int queued, timeout = 1000;
+        long elapsed = (long)((mtrlj_now() - start) * 1e3);
+
+        curl_multi_perform(multi, &running);
+        while (winner == NULL
+               && (msg = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            active--;
+            res = msg->data.result;
+            if (res == CURLE_OK)
+                winner = msg->easy_handle;
+        }
+
+        if (winner || active == 0)
+            break;
+
+        if (!hedged && elapsed >= delay) {
+            hedged = 1;
+            hedge_urlp = curl_url_dup(urlp);
+            hedge = mtrlj_curl_easy(hedge_urlp, headers, transfer, &hedge_mcp);
+            if (hedge) {
+                curl_multi_add_handle(multi, hedge);
+                mtrlj_count(&mtrlj_transport.stats.hedges);
+                active++;
+            } else {
+                curl_url_cleanup(hedge_urlp);
+                hedge_urlp = NULL;
+            }
+            continue;
+        }
+
+        if (!hedged && delay - elapsed < timeout)
+            timeout = (int)(delay - elapsed);
+        curl_multi_poll(multi, NULL, 0, timeout, NULL);
+    }
+
+    if (winner) {
+        curl_easy_getinfo(winner, CURLINFO_RESPONSE_CODE, &mcp->status);
+        if (winner == hedge) {
+            struct mtrlj_curl_response swap = *mcp;
+
+            mtrlj_count(&mtrlj_transport.stats.hedge_wins);
+            *mcp = hedge_mcp;
+            mcp->status = swap.status;
+            hedge_mcp = swap;
+        }
+    }
+
+    /* removing the loser cancels it */
+    curl_multi_remove_handle(multi, curl);
+    if (hedge) {
+        curl_multi_remove_handle(multi, hedge);
+        curl_easy_cleanup(hedge);
+    }
+    curl_multi_cleanup(multi);
+    curl_url_cleanup(hedge_urlp);
+    free(hedge_mcp.response);
+
+    return res;
+}
+
+/* Does the transfer, adding conditional headers if there is a cached entry. */
+static CURLcode mtrlj_curl_perform(CURLU *urlp,
+                                   const struct mtrlj_cache_entry *cached,
+                                   struct mtrlj_curl_response *mcp)
+{
+    CURL *curl;
+    CURLcode res = CURLE_FAILED_INIT;
+    struct curl_slist *hchunk;
+    long transfer = mtrlj_timing_copy().transfer;
+    long remaining = mtrlj_call_remaining();
+    long delay = -1;
+    int hedgeable;
+    double start;
+
+    if (remaining == 0 || !mtrlj_slot_acquire()) {
+        mtrlj_count(&mtrlj_transport.stats.deadline_hits);
+        return CURLE_OPERATION_TIMEDOUT;
+    }
+    if (!mtrlj_rate_acquire()) {
+        mtrlj_slot_release();
+        mtrlj_count(&mtrlj_transport.stats.deadline_hits);
+        return CURLE_OPERATION_TIMEDOUT;
+    }
+
+    remaining = mtrlj_call_remaining(); /* we may have waited for a token */
+    if (remaining > 0 && (transfer <= 0 || remaining < transfer))
+        transfer = remaining;
+
+    hchunk = mtrlj_request_headers(cached);
+    curl = mtrlj_curl_easy(urlp, hchunk, transfer, mcp);
+    if (!curl) {
+        mtrlj_slot_release();
+        curl_slist_free_all(hchunk);
+        return res;
+    }
+
+    hedgeable = mtrlj_hedgeable(urlp);
+    if (hedgeable)
+        delay = mtrlj_hedge_delay();
+
+    start = mtrlj_now();
+    if (delay >= 0) {
+        res = mtrlj_curl_hedged(curl, urlp, hchunk, transfer, delay, mcp);
+    } else {
+        res = curl_easy_perform(curl);
+        if (res == CURLE_OK)
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &mcp->status);
+    }
+
+    if (res == CURLE_OPERATION_TIMEDOUT)
+        mtrlj_count(&mtrlj_transport.stats.timeouts);
+    if (res != CURLE_OK)
+        fprintf(stderr, "curl_easy_perform() failed: %s\n",
+                curl_easy_strerror(res));
+    else if (hedgeable && mcp->status < 400)
+        mtrlj_latency_record((mtrlj_now() - start) * 1e3);
+    mtrlj_call_state()->transfer_time += mtrlj_now() - start;
+
+    mtrlj_slot_release();
+    curl_easy_cleanup(curl);
+    curl_slist_free_all(hchunk);
+    return res;
+}
+
+/* Circuit breakers. A small table of endpoints, found by their path. */
+
+#define MTRLJ_BREAKER_ENDPOINTS 16
+
+typedef enum {
+    MTRLJ_BREAKER_CLOSED = 0,
+    MTRLJ_BREAKER_OPEN,
+    MTRLJ_BREAKER_HALF_OPEN
+} MTRLJ_BREAKER_STATE;
+
+static struct {
+    int threshold;
+    long open_time;
+    struct {
+        char path[64];
+        MTRLJ_BREAKER_STATE state;
+        int failures;
+        double opened_at;
+    } endpoints[MTRLJ_BREAKER_ENDPOINTS];
+} mtrlj_breaker;
+
+static pthread_mutex_t mtrlj_breaker_lock = PTHREAD_MUTEX_INITIALIZER;
+
+MTRLJ_CODE mtrlj_set_circuit_breaker(int failures, long open_time)
+{
+    pthread_mutex_lock(&mtrlj_breaker_lock);
+    memset(&mtrlj_breaker, 0, sizeof(mtrlj_breaker));
+    mtrlj_breaker.threshold = failures > 0 ? failures : 0;
+    mtrlj_breaker.open_time = open_time > 0 ? open_time : 0;
+    pthread_mutex_unlock(&mtrlj_breaker_lock);
+    return MTRLJ_OK;
+}
+
+/* Index of the endpoint of `urlp`, added if new, -1 if there's no room. */
+static int mtrlj_breaker_find(CURLU *urlp)
+{
+    char *path = NULL;
+    int found = -1;
+    int i;
+
+    if (curl_url_get(urlp, CURLUPART_PATH, &path, 0) != CURLUE_OK)
+        return -1;
+
+    for (i = 0; i < MTRLJ_BREAKER_ENDPOINTS; i++) {
+        if (!mtrlj_breaker.endpoints[i].path[0]) {
+            strncpy(mtrlj_breaker.endpoints[i].path, path,
+                    sizeof(mtrlj_breaker.endpoints[i].path) - 1);
+            found = i;
+            break;
+        }
+        if (strncmp(mtrlj_breaker.endpoints[i].path, path,
+                    sizeof(mtrlj_breaker.endpoints[i].path) - 1)
+            == 0) {
+            found = i;
+            break;
+        }
+    }
+
+    curl_free(path);
+    return found;
+}
+
+/* Whether a request may be sent to the endpoint of `urlp`. In half open
+   state only the first asking gets to probe it. */
+static int mtrlj_breaker_allow(CURLU *urlp)
+{
+    int allow = 1;
+    int i;
+
+    pthread_mutex_lock(&mtrlj_breaker_lock);
+
+    if (mtrlj_breaker.threshold && (i = mtrlj_breaker_find(urlp)) >= 0) {
+        switch (mtrlj_breaker.endpoints[i].state) {
+        case MTRLJ_BREAKER_CLOSED:
+            break;
+        case MTRLJ_BREAKER_OPEN:
+            if ((mtrlj_now() - mtrlj_breaker.endpoints[i].opened_at) * 1e3
+                >= mtrlj_breaker.open_time)
+                mtrlj_breaker.endpoints[i].state = MTRLJ_BREAKER_HALF_OPEN;
+            else
+                allow = 0;
+            break;
+        case MTRLJ_BREAKER_HALF_OPEN:
+            allow = 0; /* probe is on its way */
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&mtrlj_breaker_lock);
+
+    if (!allow)
+        mtrlj_count(&mtrlj_transport.stats.breaker_rejects);
+    return allow;
+}
+
+static void mtrlj_breaker_record(CURLU *urlp, int healthy)
+{
+    int tripped = 0;
+    int i;
+
+    pthread_mutex_lock(&mtrlj_breaker_lock);
+
+    if (mtrlj_breaker.threshold && (i = mtrlj_breaker_find(urlp)) >= 0) {
+        if (healthy) {
+            mtrlj_breaker.endpoints[i].state = MTRLJ_BREAKER_CLOSED;
+            mtrlj_breaker.endpoints[i].failures = 0;
+        } else if (mtrlj_breaker.endpoints[i].state == MTRLJ_BREAKER_HALF_OPEN
+                   || ++mtrlj_breaker.endpoints[i].failures
+                          >= mtrlj_breaker.threshold) {
+            tripped = mtrlj_breaker.endpoints[i].state != MTRLJ_BREAKER_OPEN;
+            mtrlj_breaker.endpoints[i].state = MTRLJ_BREAKER_OPEN;
+            mtrlj_breaker.endpoints[i].opened_at = mtrlj_now();
+        }
+    }
+
+    pthread_mutex_unlock(&mtrlj_breaker_lock);
+
+    if (tripped)
+        mtrlj_count(&mtrlj_transport.stats.breaker_trips);
+}
+
+/* Takes the answer of a transfer for `full_url`, made conditionally if
+   `cached` is set, and updates the caches with it. Returns if it is usable. */
+static int mtrlj_cache_store(CURLU *urlp, const char *full_url,
+                             struct mtrlj_cache_entry *entry, int cached,
+                             CURLcode res, struct mtrlj_curl_response *mcp)
+{
+    int ok;
+
+    mtrlj_breaker_record(urlp, res == CURLE_OK && mcp->status != 429
+                                   && mcp->status < 500);
+
+    ok = res == CURLE_OK
+         && (mcp->status == 200 || (cached && mcp->status == 304));
+    if (!ok)
+        mtrlj_count(&mtrlj_transport.stats.failed_requests);
+
+    if (ok && mcp->status == 304) {
+        /* our copy is still good, keep its validators if MGM didn't send */
+        mtrlj_count(&mtrlj_transport.stats.not_modified);
+        free(mcp->response);
+        mcp->response = entry->body;
+        mcp->size = entry->size;
+        mcp->status = 200;
+        entry->body = NULL;
+        if (!mcp->etag[0])
+            strcpy(mcp->etag, entry->etag);
+        if (!mcp->last_modified[0])
+            strcpy(mcp->last_modified, entry->last_modified);
+    }
+
+    if (ok && full_url)
+        mtrlj_cache_write(full_url, (long)time(NULL), mcp);
+    if (ok && full_url)
+        mtrlj_memory_put(full_url, (long)time(NULL), mcp);
+
+    return ok;
+}
+
+/* Asks MGM for `full_url`, conditionally if `cached` is set, and updates the
+   disk cache with the answer. Callers check mtrlj_breaker_allow first. */
+static int mtrlj_cache_fetch(CURLU *urlp, const char *full_url,
+                             struct mtrlj_cache_entry *entry, int cached,
+                             struct mtrlj_curl_response *mcp)
+{
+    int max_retries = mtrlj_timing_copy().max_retries;
+    CURLcode res;
+    int attempt;
+
+    for (attempt = 0;; attempt++) {
+        long delay, remaining;
+
+        res = mtrlj_curl_perform(urlp, cached ? entry : NULL, mcp);
+        mtrlj_count(&mtrlj_transport.stats.requests);
+
+        if ((res == CURLE_OK && mcp->status != 429 && mcp->status < 500)
+            || attempt >= max_retries)
+            break;
+
+        /* no point in waiting if there won't be time left for it */
+        delay = mtrlj_backoff(attempt);
+        remaining = mtrlj_call_remaining();
+        if (remaining >= 0 && delay >= remaining)
+            break;
+
+        mtrlj_count(&mtrlj_transport.stats.retries);
+        free(mcp->response);
+        memset(mcp, 0, sizeof(*mcp));
+        mtrlj_sleep_ms(delay);
+    }
+
+    return mtrlj_cache_store(urlp, full_url, entry, cached, res, mcp);
+}
+
+/* curl_global_init isn't thread safe. Whatever starts a library thread or a
+   loop initializes curl through here first, it is cleaned up only by
+   mtrlj_shutdown once those threads are joined. */
+
+static pthread_mutex_t mtrlj_curl_global_lock = PTHREAD_MUTEX_INITIALIZER;
+static int mtrlj_curl_global_done;
+
+static void mtrlj_curl_global_once(void)
+{
+    pthread_mutex_lock(&mtrlj_curl_global_lock);
+    if (!mtrlj_curl_global_done) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        mtrlj_curl_global_done = 1;
+    }
+    pthread_mutex_unlock(&mtrlj_curl_global_lock);
+}
+
+static void mtrlj_curl_global_cleanup(void)
+{
+    pthread_mutex_lock(&mtrlj_curl_global_lock);
+    if (mtrlj_curl_global_done) {
+        curl_global_cleanup();
+        mtrlj_curl_global_done = 0;
+    }
+    pthread_mutex_unlock(&mtrlj_curl_global_lock);
+}
+
+/* Background refresher for stale-while-revalidate. URLs wait in a queue and
+   one thread revalidates them one by one. */
+
+struct mtrlj_refresh {
+    struct mtrlj_refresh *next;
+    char *url;
+};
+
+static struct {
+    struct mtrlj_refresh *head, *tail;
+    int started, stopping;
+} mtrlj_refresher;
+
+static pthread_mutex_t mtrlj_refresher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mtrlj_refresher_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t mtrlj_refresher_thread;
+
+static void mtrlj_refresh_url(const char *url)
+{
+    struct mtrlj_cache_entry entry = {0};
+    struct mtrlj_curl_response mcp = {0};
+    long max_age, max_stale;
+    size_t memory_bytes;
+    CURLU *urlp;
+    int cached;
+
+    cached = mtrlj_cache_read(url, &entry);
+    mtrlj_cache_settings(&max_age, &max_stale, &memory_bytes);
+
+    /* it could be queued twice, or be refreshed by a caller meanwhile */
+    if (cached && (long)time(NULL) - entry.fetched < max_age) {
+        free(entry.body);
+        return;
+    }
+
+    urlp = curl_url();
+    if (curl_url_set(urlp, CURLUPART_URL, url, 0) == CURLUE_OK
+        && mtrlj_breaker_allow(urlp)
+        && mtrlj_cache_fetch(urlp, url, &entry, cached, &mcp))
+        mtrlj_count(&mtrlj_transport.stats.refreshes);
+
+    curl_url_cleanup(urlp);
+    free(entry.body);
+    free(mcp.response);
+}
+
+static void *mtrlj_refresher_main(void *unused)
+{
+    struct mtrlj_refresh *refresh;
+    (void)unused;
+
+    mtrlj_set_priority(MTRLJ_PRIORITY_BACKGROUND);
+
+    pthread_mutex_lock(&mtrlj_refresher_lock);
+    for (;;) {
+        while (mtrlj_refresher.head == NULL && !mtrlj_refresher.stopping)
+            pthread_cond_wait(&mtrlj_refresher_wake, &mtrlj_refresher_lock);
+
+        if (mtrlj_refresher.stopping)
+            break;
+
+        refresh = mtrlj_refresher.head;
+        mtrlj_refresher.head = refresh->next;
+        if (mtrlj_refresher.head == NULL)
+            mtrlj_refresher.tail = NULL;
+
+        pthread_mutex_unlock(&mtrlj_refresher_lock);
+        mtrlj_refresh_url(refresh->url);
+        free(refresh->url);
+        free(refresh);
+        pthread_mutex_lock(&mtrlj_refresher_lock);
+    }
+    pthread_mutex_unlock(&mtrlj_refresher_lock);
+
+    return NULL;
+}
+
+/* Returns 0 if the refresher couldn't be started, the caller should fetch the
+   URL itself then. */
+static int mtrlj_refresh_later(const char *url)
+{
+    struct mtrlj_refresh *refresh;
+    int ok = 1;
+
+    pthread_mutex_lock(&mtrlj_refresher_lock);
+
+    if (!mtrlj_refresher.started) {
+        mtrlj_curl_global_once();
+        if (pthread_create(&mtrlj_refresher_thread, NULL, mtrlj_refresher_main,
+                           NULL)
+            != 0) {
+            ok = 0;
+            goto end;
+        }
+        mtrlj_refresher.started = 1;
+    }
+
+    for (refresh = mtrlj_refresher.head; refresh; refresh = refresh->next) {
+        if (strcmp(refresh->url, url) == 0)
+            goto end;
+    }
+
+    refresh = malloc(sizeof(struct mtrlj_refresh));
+    refresh->next = NULL;
+    refresh->url = malloc(strlen(url) + 1);
+    strcpy(refresh->url, url);
+
+    if (mtrlj_refresher.tail)
+        mtrlj_refresher.tail->next = refresh;
+    else
+        mtrlj_refresher.head = refresh;
+    mtrlj_refresher.tail = refresh;
+    pthread_cond_signal(&mtrlj_refresher_wake);
+
+end:
+    pthread_mutex_unlock(&mtrlj_refresher_lock);
+    return ok;
+}
+
+static void mtrlj_engine_stop(void);
+static void mtrlj_batch_stop(void);
+
+void mtrlj_shutdown(void)
+{
+    struct mtrlj_refresh *refresh;
+
+    mtrlj_set_thread_pool(0);
+    mtrlj_engine_stop();
+    mtrlj_batch_stop();
+
+    pthread_mutex_lock(&mtrlj_refresher_lock);
+    mtrlj_refresher.stopping = 1;
+    pthread_cond_signal(&mtrlj_refresher_wake);
+    pthread_mutex_unlock(&mtrlj_refresher_lock);
+
+    if (mtrlj_refresher.started)
+        pthread_join(mtrlj_refresher_thread, NULL);
+
+    while ((refresh = mtrlj_refresher.head) != NULL) {
+        mtrlj_refresher.head = refresh->next;
+        free(refresh->url);
+        free(refresh);
+    }
+    memset(&mtrlj_refresher, 0, sizeof(mtrlj_refresher));
+
+    mtrlj_set_cache_dir(NULL, 0);
+    mtrlj_set_memory_cache(0, 0);
+    mtrlj_set_negative_cache(0);
+    mtrlj_shared_cache_close();
+    mtrlj_curl_global_cleanup();
+}
+
+static CURLU *mtrlj_url(const char *url, const char **params,
+                        size_t param_count)
+{
+    CURLU *urlp;
+    CURLUcode uc;
+    size_t i;
+
+    urlp = curl_url();
+    uc = curl_url_set(urlp, CURLUPART_URL, url, 0);
+    for (i = 0; i < param_count; i++) {
+        uc = curl_url_set(urlp, CURLUPART_QUERY, params[i],
+                          CURLU_APPENDQUERY | CURLU_URLENCODE);
+    }
+
+    if (uc) {
+        curl_url_cleanup(urlp);
+        return NULL;
+    }
+
+    return urlp;
+}
+
+/* Answers `urlp` from memory or disk cache if it can. Otherwise leaves the
+   full url in `full_url` if caches are on, and the disk cache entry in
+   `entry` if `cached`, for making the request. */
+static int mtrlj_cache_lookup(CURLU *urlp, char **full_url,
+                              struct mtrlj_cache_entry *entry, int *cached,
+                              struct mtrlj_curl_response *mcp)
+{
+    long max_age, max_stale;
+    size_t memory_bytes;
+    int disk;
+
+    *full_url = NULL;
+    *cached = 0;
+    disk = mtrlj_cache_settings(&max_age, &max_stale, &memory_bytes);
+
+    if ((disk || memory_bytes)
+        && curl_url_get(urlp, CURLUPART_URL, full_url, 0) == CURLUE_OK) {
+        if (mtrlj_memory_get(*full_url, mcp))
+            return 1;
+    }
+
+    if (*full_url && disk) {
+        *cached = mtrlj_cache_read(*full_url, entry);
+
+        if (*cached) {
+            long age = (long)time(NULL) - entry->fetched;
+            int fresh = age < max_age;
+
+            if (fresh
+                || (age < max_age + max_stale
+                    && mtrlj_refresh_later(*full_url))) {
+                mtrlj_count(fresh ? &mtrlj_transport.stats.disk_hits
+                                  : &mtrlj_transport.stats.stale_hits);
+                mcp->response = entry->body;
+                mcp->size = entry->size;
+                mcp->status = 200;
+                mcp->age = age > 0 ? age : 0;
+                entry->body = NULL;
+                if (fresh)
+                    mtrlj_memory_put(*full_url, entry->fetched, mcp);
+                return 1;
+            }
+        }
+
+        mtrlj_count(&mtrlj_transport.stats.disk_misses);
+    }
+
+    return 0;
+}
+
+/* For when the breaker is open, MGM is down, old data is better than none. */
+static int mtrlj_cache_fallback(struct mtrlj_cache_entry *entry, int cached,
+                                struct mtrlj_curl_response *mcp)
+{
+    long age = (long)time(NULL) - entry->fetched;
+
+    if (!cached)
+        return 0;
+
+    mtrlj_count(&mtrlj_transport.stats.stale_hits);
+    mcp->response = entry->body;
+    mcp->size = entry->size;
+    mcp->status = 200;
+    mcp->age = age > 0 ? age : 0;
+    entry->body = NULL;
+    return 1;
+}
+
+static int mtrlj_curl_get_cached(const char *url, const char **params,
+                                 size_t param_count,
+                                 struct mtrlj_curl_response *mcp)
+{
+    CURLU *urlp;
+    char *full_url;
+    struct mtrlj_cache_entry entry = {0};
+    int cached;
+    int ok;
+
+    urlp = mtrlj_url(url, params, param_count);
+    if (!urlp)
+        return 0;
+
+    if (mtrlj_cache_lookup(urlp, &full_url, &entry, &cached, mcp))
+        ok = 1;
+    else if (mtrlj_breaker_allow(urlp))
+        ok = mtrlj_cache_fetch(urlp, full_url, &entry, cached, mcp);
+    else
+        ok = mtrlj_cache_fallback(&entry, cached, mcp);
+
+    free(entry.body);
+    curl_free(full_url);
+    curl_url_cleanup(urlp);
+
+    return ok;
+}
+
+int mtrlj_curl_get_params(const char *url, const char **params,
+                          size_t param_count, struct mtrlj_curl_response *mcp)
+{
+    int ok;
+
+    mtrlj_call_begin();
+    ok = mtrlj_curl_get_cached(url, params, param_count, mcp);
+    mtrlj_call_end();
+
+    return ok;
+}
+
+int mtrlj_curl_get(const char *url, struct mtrlj_curl_response *mcp)
+{
+    return mtrlj_curl_get_params(url, NULL, 0, mcp);
+}
+
+/* District parsing helper */
+
+/* Fills everything except the names, which are returned for the caller to copy
+   wherever it wants. */
+MTRLJ_CODE mtrlj_json_parse_district_fields(const cJSON *district_json,
+                                            struct mtrlj_district *district,
+                                            const char **name,
+                                            const char **city_name)
+{
+    cJSON *id = cJSON_GetObjectItem(district_json, "merkezId");
+    cJSON *height = cJSON_GetObjectItem(district_json, "yukseklik");
+    cJSON *daily_forecast_station =
+        cJSON_GetObjectItem(district_json, "gunlukTahminIstNo");
+    cJSON *hourly_forecast_station =
+        cJSON_GetObjectItem(district_json, "saatlikTahminIstNo");
+    cJSON *longitude = cJSON_GetObjectItem(district_json, "boylam");
+    cJSON *latitude = cJSON_GetObjectItem(district_json, "enlem");
+    cJSON *name_json = cJSON_GetObjectItem(district_json, "ilce");
+    cJSON *city_name_json = cJSON_GetObjectItem(district_json, "il");
+    cJSON *city_plate_code = cJSON_GetObjectItem(district_json, "ilPlaka");
+
+    if (!cJSON_IsNumber(id) || !cJSON_IsNumber(height)
+        || !cJSON_IsNumber(longitude) || !cJSON_IsNumber(latitude)
+        || !cJSON_IsNumber(city_plate_code) || !cJSON_IsString(name_json)
+        || !cJSON_IsString(city_name_json) || (name_json->valuestring == NULL)
+        || (city_name_json->valuestring == NULL)) {
+        return MTRLJ_JSON_PARSING_FAILED;
+    }
+
+    district->id = id->valueint;
+    district->height = height->valueint;
+    district->daily_forecast_station = 0;
+    district->hourly_forecast_station = 0;
+    if (cJSON_IsNumber(daily_forecast_station))
+        district->daily_forecast_station = daily_forecast_station->valueint;
+    if (cJSON_IsNumber(hourly_forecast_station))
+        district->hourly_forecast_station = hourly_forecast_station->valueint;
+    district->longitude = longitude->valuedouble;
+    district->latitude = latitude->valuedouble;
+    district->city_plate_code = city_plate_code->valueint;
+
+    *name = name_json->valuestring;
+    *city_name = city_name_json->valuestring;
+
+    return MTRLJ_OK;
+}
+
+MTRLJ_CODE mtrlj_json_parse_district(const cJSON *district_json,
+                                     struct mtrlj_district *district)
+{
+    size_t name_size;
+    size_t city_name_size;
+    const char *name;
+    const char *city_name;
+    MTRLJ_CODE res;
+
+    res = mtrlj_json_parse_district_fields(district_json, district, &name,
+                                           &city_name);
+    if (res != MTRLJ_OK)
+        return res;
+
+    name_size = (strlen(name) + 1) * sizeof(char);
+    district->name = malloc(name_size);
+    memcpy(district->name, name, name_size);
+
+    city_name_size = (strlen(city_name) + 1) * sizeof(char);
+    district->city_name = malloc(city_name_size);
+    memcpy(district->city_name, city_name, city_name_size);
+
+    return MTRLJ_OK;
+}
+
+/* Names are copied into `names` starting from `*names_used`, `*names_used` is
+   advanced even if they don't fit so caller can learn the needed size. */
+MTRLJ_CODE mtrlj_json_parse_district_buf(const cJSON *district_json,
+                                         struct mtrlj_district *district,
+                                         char *names, size_t names_capacity,
+                                         size_t *names_used)
+{
+    size_t name_size;
+    size_t city_name_size;
+    const char *name;
+    const char *city_name;
+    MTRLJ_CODE res;
+
+    res = mtrlj_json_parse_district_fields(district_json, district, &name,
+                                           &city_name);
+    if (res != MTRLJ_OK)
+        return res;
+
+    name_size = strlen(name) + 1;
+    city_name_size = strlen(city_name) + 1;
+
+    if (*names_used + name_size + city_name_size > names_capacity) {
+        district->name = NULL;
+        district->city_name = NULL;
+        *names_used += name_size + city_name_size;
+        return MTRLJ_BUFFER_TOO_SMALL;
+    }
+
+    district->name = names + *names_used;
+    memcpy(district->name, name, name_size);
+    *names_used += name_size;
+
+    district->city_name = names + *names_used;
+    memcpy(district->city_name, city_name, city_name_size);
+    *names_used += city_name_size;
+
+    return MTRLJ_OK;
+}
+
+/* Condition from 1-3 letter codes */
+MTRLJ_WEATHER_CONDITION mtrlj_condition_from_code(const char *code)
+{
+    /* i am just using bitwise operations to encode characters to shorten this
+       function */
+    size_t len;
+    uint32_t condition = 0;
+
+    len = strlen(code);
+    if (len < 1 || len > 3)
+        return MTRLJ_WEATHER_INVALID;
+
+    condition |= code[0] << 16; /* 0x00XX0000 */
+
+    if (len > 1)
+        condition |= code[1] << 8; /* 0x00xxXX00 */
+
+    if (len > 2)
+        condition |= code[2]; /* 0x00xxxxXX */
+
+    /* This condition has 2 codes(`KYK` and `YKY`) */
+    if (condition == 0x00594b59)
+        return MTRLJ_WEATHER_HEAVY_SNOWY;
+
+    return (MTRLJ_WEATHER_CONDITION)condition;
+}
+
+/* Parsing time */
+struct mtrlj_time mtrlj_parse_iso8601_time(const char *str)
+{
+    struct mtrlj_time time = {0};
+
+    /* not strtok, it keeps its state in a global and threads call this */
+    sscanf(str, "%d-%d-%dT%d:%d:%d", &time.year, &time.month, &time.day,
+           &time.hour, &time.minute, &time.second);
+
+    return time;
+}
+
+/* Parses all 5 days in the daily forecast object */
+MTRLJ_CODE
+mtrlj_json_parse_daily_forecasts(const cJSON *json,
+                                 struct mtrlj_daily_forecast *forecasts)
+{
+    char condition_key[] = "hadiseGun ";
+    char min_temp_key[] = "enDusukGun ";
+    char max_temp_key[] = "enYuksekGun ";
+    char min_humidity_key[] = "enDusukNemGun ";
+    char max_humidity_key[] = "enYuksekNemGun ";
+    char wind_speed_key[] = "ruzgarHizGun ";
+    char wind_direction_key[] = "ruzgarYonGun ";
+    char time_key[] = "tarihGun ";
+    cJSON *condition_code;
+    cJSON *temperature_min;
+    cJSON *temperature_max;
+    cJSON *humidity_min;
+    cJSON *humidity_max;
+    cJSON *wind_speed;
+    cJSON *wind_direction;
+    cJSON *time;
+    size_t i;
+
+    for (i = 0; i < 5; i++) {
+        char num = '1' + i;
+        condition_key[9] = num;
+        min_temp_key[10] = num;
+        max_temp_key[11] = num;
+        min_humidity_key[13] = num;
+        max_humidity_key[14] = num;
+        wind_speed_key[12] = num;
+        wind_direction_key[12] = num;
+        time_key[8] = num;
+
+        condition_code = cJSON_GetObjectItem(json, condition_key);
+        temperature_min = cJSON_GetObjectItem(json, min_temp_key);
+        temperature_max = cJSON_GetObjectItem(json, max_temp_key);
+        humidity_min = cJSON_GetObjectItem(json, min_humidity_key);
+        humidity_max = cJSON_GetObjectItem(json, max_humidity_key);
+        wind_speed = cJSON_GetObjectItem(json, wind_speed_key);
+        wind_direction = cJSON_GetObjectItem(json, wind_direction_key);
+        time = cJSON_GetObjectItem(json, time_key);
+
+        if (!cJSON_IsNumber(temperature_min) || !cJSON_IsNumber(temperature_max)
+            || !cJSON_IsNumber(humidity_min) || !cJSON_IsNumber(humidity_max)
+            || !cJSON_IsNumber(wind_speed) || !cJSON_IsNumber(wind_direction)
+            || !cJSON_IsString(condition_code)
+            || (condition_code->valuestring == NULL) || !cJSON_IsString(time)
+            || (time->valuestring == NULL)) {
+            return MTRLJ_JSON_PARSING_FAILED;
+        }
+
+        forecasts[i].condition =
+            mtrlj_condition_from_code(condition_code->valuestring);
+        forecasts[i].temperature_min = temperature_min->valuedouble;
+        forecasts[i].temperature_max = temperature_max->valuedouble;
+        forecasts[i].humidity_min = humidity_min->valuedouble;
+        forecasts[i].humidity_max = humidity_max->valuedouble;
+        forecasts[i].wind_speed = wind_speed->valuedouble;
+        forecasts[i].wind_direction = wind_direction->valuedouble;
+        forecasts[i].time = mtrlj_parse_iso8601_time(time->valuestring);
+    }
+
+    return MTRLJ_OK;
+}
+
+/* Parses one element of `tahmin` array in hourly forecasts */
+MTRLJ_CODE
+mtrlj_json_parse_hourly_forecast(const cJSON *forecast_json,
+                                 struct mtrlj_hourly_forecast *forecast)
+{
+    cJSON *condition_code = cJSON_GetObjectItem(forecast_json, "hadise");
+    cJSON *temperature = cJSON_GetObjectItem(forecast_json, "sicaklik");
+    cJSON *felt_temperature =
+        cJSON_GetObjectItem(forecast_json, "hissedilenSicaklik");
+    cJSON *humidity_percent = cJSON_GetObjectItem(forecast_json, "nem");
+    cJSON *wind_speed_avg = cJSON_GetObjectItem(forecast_json, "ruzgarHizi");
+    cJSON *wind_speed_max =
+        cJSON_GetObjectItem(forecast_json, "maksimumRuzgarHizi");
+    cJSON *wind_direction = cJSON_GetObjectItem(forecast_json, "ruzgarYonu");
+    cJSON *time = cJSON_GetObjectItem(forecast_json, "tarih");
+
+    if (!cJSON_IsNumber(temperature) || !cJSON_IsNumber(felt_temperature)
+        || !cJSON_IsNumber(humidity_percent) || !cJSON_IsNumber(wind_speed_avg)
+        || !cJSON_IsNumber(wind_speed_max) || !cJSON_IsNumber(wind_direction)
+        || !cJSON_IsString(condition_code)
+        || (condition_code->valuestring == NULL) || !cJSON_IsString(time)
+        || (time->valuestring == NULL)) {
+        return MTRLJ_JSON_PARSING_FAILED;
+    }
+
+    forecast->condition =
+        mtrlj_condition_from_code(condition_code->valuestring);
+    forecast->temperature = temperature->valuedouble;
+    forecast->felt_temperature = felt_temperature->valuedouble;
+    forecast->humidity_percent = humidity_percent->valuedouble;
+    forecast->wind_speed_avg = wind_speed_avg->valuedouble;
+    forecast->wind_speed_max = wind_speed_max->valuedouble;
+    forecast->wind_direction = wind_direction->valuedouble;
+    forecast->time = mtrlj_parse_iso8601_time(time->valuestring);
+
+    return MTRLJ_OK;
+}
+
+/* Endpoints asked both by blocking calls and on event loops. */
+static const char *const LATEST_SITUATION_ENDPOINT =
+    "https://servis.mgm.gov.tr/web/sondurumlar";
+static const char *const DAILY_FORECAST_ENDPOINT =
+    "https://servis.mgm.gov.tr/web/tahminler/gunluk";
+static const char *const HOURLY_FORECAST_ENDPOINT =
+    "https://servis.mgm.gov.tr/web/tahminler/saatlik";
+static const char *const PAST_VALUES_ENDPOINT =
+    "https://servis.mgm.gov.tr/web/ucdegerler";
+
+static void mtrlj_past_values_parameters(int id,
+                                         const struct mtrlj_daily_forecast
+                                             *forecast,
+                                         char parameters[3][128],
+                                         const char *url_parameters[3])
+{
+    sprintf(parameters[0], "merkezid=%d", id);
+    sprintf(parameters[1], "ay=%d", forecast->time.month);
+    sprintf(parameters[2], "gun=%d", forecast->time.day);
+    url_parameters[0] = parameters[0];
+    url_parameters[1] = parameters[1];
+    url_parameters[2] = parameters[2];
+}
+
+/* It's ok that these are not available, so set the corresponding values to
+   -9999 to inform that these are not available. */
+static void mtrlj_past_values_unavailable(struct mtrlj_daily_forecast *forecast)
+{
+    forecast->past_peak_temperature_min = -9999;
+    forecast->past_peak_temperature_max = -9999;
+    forecast->past_average_temperature_min = -9999;
+    forecast->past_average_temperature_max = -9999;
+}
+
+static MTRLJ_CODE
+mtrlj_parse_past_values(const struct mtrlj_curl_response *mcp,
+                        struct mtrlj_daily_forecast *forecast)
+{
+    MTRLJ_CODE return_code = MTRLJ_OK;
+    cJSON *past_json = NULL;
+
+    past_json = cJSON_Parse(mcp->response);
+    if (past_json == NULL || !cJSON_IsArray(past_json)
+        || cJSON_GetArraySize(past_json) != 1) {
+        return_code = MTRLJ_JSON_PARSING_FAILED;
+        goto end;
+    }
+
+    {
+        cJSON *json = cJSON_GetArrayItem(past_json, 0);
+        cJSON *past_peak_temperature_min = cJSON_GetObjectItem(json, "min");
+        cJSON *past_peak_temperature_max = cJSON_GetObjectItem(json, "max");
+        cJSON *past_average_temperature_min =
+            cJSON_GetObjectItem(json, "minOrt");
+        cJSON *past_average_temperature_max =
+            cJSON_GetObjectItem(json, "maxOrt");
+
+        if (!cJSON_IsNumber(past_peak_temperature_min)
+            || !cJSON_IsNumber(past_peak_temperature_max)
+            || !cJSON_IsNumber(past_average_temperature_min)
+            || !cJSON_IsNumber(past_average_temperature_max)) {
+            return_code = MTRLJ_JSON_PARSING_FAILED;
+            goto end;
+        }
+
+        forecast->past_peak_temperature_min =
+            past_peak_temperature_min->valuedouble;
+        forecast->past_peak_temperature_max =
+            past_peak_temperature_max->valuedouble;
+        forecast->past_average_temperature_min =
+            past_average_temperature_min->valuedouble;
+        forecast->past_average_temperature_max =
+            past_average_temperature_max->valuedouble;
+    }
+
+end:
+    cJSON_Delete(past_json);
+    return return_code;
+}
+
+/* Getting past min and max values for a daily forecast */
+MTRLJ_CODE mtrlj_get_past_values(int id, struct mtrlj_daily_forecast *forecast)
+{
+    char parameters[3][128];
+    const char *url_parameters[3];
+    MTRLJ_CODE return_code;
+    struct mtrlj_curl_response mcp = {0};
+
+    mtrlj_past_values_parameters(id, forecast, parameters, url_parameters);
+
+    if (!mtrlj_curl_get_params(PAST_VALUES_ENDPOINT, url_parameters, 3,
+                               &mcp))
+        return_code = MTRLJ_REQUEST_FAILED;
+    else
+        return_code = mtrlj_parse_past_values(&mcp, forecast);
+
+    free(mcp.response);
+    return return_code;
+}
+
+/* Exposed functions */
+
+#ifndef METEOROLOJI_EMBED_CATALOG
+static const char *const CITIES_ENDPOINT =
+    "https://servis.mgm.gov.tr/web/merkezler/iller";
+static const char *const DISTRICTS_ENDPOINT =
+    "https://servis.mgm.gov.tr/web/merkezler/ililcesi";
+
+/* Cities and districts in a city come as the same array. */
+static MTRLJ_CODE mtrlj_parse_districts(const struct mtrlj_curl_response *mcp,
+                                        struct mtrlj_district **districts,
+                                        size_t *size)
+{
+    MTRLJ_CODE return_code = MTRLJ_OK;
+    cJSON *districts_json = NULL;
+    const cJSON *district_json = NULL;
+    size_t i;
+
+    districts_json = cJSON_Parse(mcp->response);
+    if (districts_json == NULL || !cJSON_IsArray(districts_json)) {
+        return_code = MTRLJ_JSON_PARSING_FAILED;
+        goto end;
+    }
+
+    *size = cJSON_GetArraySize(districts_json);
+    *districts = calloc(*size, sizeof(struct mtrlj_district));
+
+    i = 0;
+    cJSON_ArrayForEach(district_json, districts_json)
+    {
+        MTRLJ_CODE res =
+            mtrlj_json_parse_district(district_json, *districts + i);
+
+        if (res != MTRLJ_OK) {
+            return_code = res;
+            goto end;
+        }
+
+        i++;
+    }
+
+end:
+    cJSON_Delete(districts_json);
+    return return_code;
+}
+
+MTRLJ_CODE mtrlj_get_cities(struct mtrlj_district **cities, size_t *size)
+{
+    MTRLJ_CODE return_code;
+    struct mtrlj_curl_response mcp = {0};
+
+    if (!mtrlj_curl_get(CITIES_ENDPOINT, &mcp))
+        return_code = MTRLJ_REQUEST_FAILED;
+    else
+        return_code = mtrlj_parse_districts(&mcp, cities, size);
+
+    free(mcp.response);
+    return return_code;
+}
+
+MTRLJ_CODE mtrlj_get_district(struct mtrlj_district *district,
+                              const char *city_name, const char *district_name)
+{
+    const char *DISTRICT_ENDPOINT = "https://servis.mgm.gov.tr/web/merkezler";
+    char *url_parameters[2];
+    MTRLJ_CODE return_code = MTRLJ_OK;
+    struct mtrlj_curl_response mcp = {0};
+    cJSON *district_json = NULL;
+
+    url_parameters[0] = calloc(128, sizeof(char));
+    url_parameters[1] = calloc(128, sizeof(char));
+    sprintf(url_parameters[0], "il=%s", city_name);
+    sprintf(url_parameters[1], "ilce=%s", district_name);
+
+    if (!mtrlj_curl_get_params(DISTRICT_ENDPOINT, (const char **)url_parameters,
+                               2, &mcp)) {
+        return_code = MTRLJ_REQUEST_FAILED;
+        goto end;
+    }
+
+    district_json = cJSON_Parse(mcp.response);
+    if (district_json == NULL || !cJSON_IsArray(district_json)
+        || cJSON_GetArraySize(district_json) != 1) {
+        return_code = MTRLJ_JSON_PARSING_FAILED;
+        goto end;
+    }
+
+    return_code = mtrlj_json_parse_district(
+        cJSON_GetArrayItem(district_json, 0), district);
+
+end:
+    free(url_parameters[0]);
+    free(url_parameters[1]);
+    cJSON_Delete(district_json);
+    free(mcp.response);
+    return return_code;
+}
+
+MTRLJ_CODE mtrlj_get_districts_in_city(struct mtrlj_district **districts,
+                                       size_t *size, const char *city_name)
+{
+    char parameter[128];
+    const char *url_parameter = parameter;
+    MTRLJ_CODE return_code;
+    struct mtrlj_curl_response mcp = {0};
+
+    sprintf(parameter, "il=%.100s", city_name);
+
+    if (!mtrlj_curl_get_params(DISTRICTS_ENDPOINT, &url_parameter, 1, &mcp))
+        return_code = MTRLJ_REQUEST_FAILED;
+    else
+        return_code = mtrlj_parse_districts(&mcp, districts, size);
+
+    free(mcp.response);
+    return return_code;
+}
+
+#else
+
+/* City in embedded tables with the given name, compared folded. */
+static const struct mtrlj_district *mtrlj_embedded_city(const char *city_name)
+{
+    char folded[256], other[256];
+    size_t i;
+
+    mtrlj_fold_name(city_name, folded, 256);
+    for (i = 0; i < MTRLJ_EMBEDDED_CITY_COUNT; i++) {
+        mtrlj_fold_name(mtrlj_embedded_cities[i].city_name, other, 256);
+        if (strcmp(folded, other) == 0)
+            return mtrlj_embedded_cities + i;
+    }
+
+    return NULL;
+}
+
+/* Districts of the tables in the city, NULL if there is no such city. */
+static const struct mtrlj_district *
+mtrlj_embedded_city_districts(const char *city_name, size_t *size)
+{
+    const struct mtrlj_district *city = mtrlj_embedded_city(city_name);
+    size_t begin;
+
+    if (city == NULL)
+        return NULL;
+
+    begin = mtrlj_embedded_plate_offsets[city->city_plate_code];
+    *size = mtrlj_embedded_plate_offsets[city->city_plate_code + 1] - begin;
+    return mtrlj_embedded_districts + begin;
+}
+
+/* Copies districts of the tables to the heap so that they can be sorted and
+   such, their names stay in the tables. */
+static struct mtrlj_district *
+mtrlj_embedded_copy(const struct mtrlj_district *districts, size_t size)
+{
+    struct mtrlj_district *copy =
+        malloc((size ? size : 1) * sizeof(struct mtrlj_district));
+
+    memcpy(copy, districts, size * sizeof(struct mtrlj_district));
+    return copy;
+}
+
+MTRLJ_CODE mtrlj_get_cities(struct mtrlj_district **cities, size_t *size)
+{
+    *cities = mtrlj_embedded_copy(mtrlj_embedded_cities,
+                                  MTRLJ_EMBEDDED_CITY_COUNT);
+    *size = MTRLJ_EMBEDDED_CITY_COUNT;
+    return MTRLJ_OK;
+}
+
+MTRLJ_CODE mtrlj_get_district(struct mtrlj_district *district,
+                              const char *city_name, const char *district_name)
+{
+    const struct mtrlj_district *city = mtrlj_embedded_city(city_name);
+    char folded[256], other[256];
+    size_t i;
+
+    if (city == NULL)
+        return MTRLJ_NOT_AVAILABLE;
+
+    if (district_name == NULL || district_name[0] == 0) {
+        *district = *city;
+        return MTRLJ_OK;
+    }
+
+    mtrlj_fold_name(district_name, folded, 256);
+    for (i = mtrlj_embedded_plate_offsets[city->city_plate_code];
+         i < mtrlj_embedded_plate_offsets[city->city_plate_code + 1]; i++) {
+        mtrlj_fold_name(mtrlj_embedded_districts[i].name, other, 256);
+        if (strcmp(folded, other) == 0) {
+            *district = mtrlj_embedded_districts[i];
+            return MTRLJ_OK;
+        }
+    }
+
+    return MTRLJ_NOT_AVAILABLE;
+}
+
+MTRLJ_CODE mtrlj_get_districts_in_city(struct mtrlj_district **districts,
+                                       size_t *size, const char *city_name)
+{
+    const struct mtrlj_district *embedded =
+        mtrlj_embedded_city_districts(city_name, size);
+
+    if (embedded == NULL)
+        return MTRLJ_NOT_AVAILABLE;
+
+    *districts = mtrlj_embedded_copy(embedded, *size);
+    return MTRLJ_OK;
+}
+#endif
+
+/* What is asked from MGM, with district id or station number they are keys of
+   negative and shared memory caches. */
+enum {
+    MTRLJ_PRODUCT_SITUATION = 1,
+    MTRLJ_PRODUCT_DAILY,
+    MTRLJ_PRODUCT_HOURLY
+};
+
+#define MTRLJ_PRODUCT_TAG(product, key) ((unsigned long)(product) << 28 | (key))
+
+/* More than MGM ever returns for a station. */
+#define MTRLJ_HOURLY_FORECAST_MAX 32
+
+union mtrlj_payload {
+    struct mtrlj_situation situation;
+    struct mtrlj_daily_forecast daily[5];
+    struct mtrlj_hourly_forecast hourly[MTRLJ_HOURLY_FORECAST_MAX];
+};
+
+/* Negative cache, remembers products which MGM doesn't have (404) or returns
+   in a shape we can't parse. It is an open addressing table of tags, entries
+   are never removed but expire. */
+
+struct mtrlj_negative_entry {
+    unsigned long tag;
+    long until;
+    MTRLJ_CODE code;
+};
+
+static struct {
+    struct mtrlj_negative_entry *entries;
+    size_t capacity, size;
+    long ttl;
+} mtrlj_negative;
+
+MTRLJ_CODE mtrlj_set_negative_cache(long ttl)
+{
+    pthread_mutex_lock(&mtrlj_transport_lock);
+
+    mtrlj_negative.ttl = ttl;
+    if (ttl == 0) {
+        free(mtrlj_negative.entries);
+        memset(&mtrlj_negative, 0, sizeof(mtrlj_negative));
+    }
+
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return MTRLJ_OK;
+}
+
+static struct mtrlj_negative_entry *mtrlj_negative_slot(unsigned long tag)
+{
+    size_t i = (tag * 2654435761UL) & (mtrlj_negative.capacity - 1);
+
+    while (mtrlj_negative.entries[i].tag != 0
+           && mtrlj_negative.entries[i].tag != tag)
+        i = (i + 1) & (mtrlj_negative.capacity - 1);
+
+    return &mtrlj_negative.entries[i];
+}
+
+/* Returns 1 and the code of the last failure if it shouldn't be asked. */
+static int mtrlj_negative_get(int product, int key, MTRLJ_CODE *code)
+{
+    struct mtrlj_negative_entry *entry;
+    int hit = 0;
+
+    pthread_mutex_lock(&mtrlj_transport_lock);
+
+    if (mtrlj_negative.size == 0)
+        goto end;
+
+    entry = mtrlj_negative_slot(MTRLJ_PRODUCT_TAG(product, key));
+    if (entry->tag != 0 && entry->until > (long)time(NULL)) {
+        *code = entry->code;
+        mtrlj_transport.stats.negative_hits++;
+        hit = 1;
+    }
+
+end:
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return hit;
+}
+
+static void mtrlj_negative_put(int product, int key, MTRLJ_CODE code,
+                               long status)
+{
+    struct mtrlj_negative_entry *entry;
+    int failed = code == MTRLJ_JSON_PARSING_FAILED || status == 404;
+
+    pthread_mutex_lock(&mtrlj_transport_lock);
+
+    if (mtrlj_negative.ttl <= 0 || (!failed && mtrlj_negative.size == 0))
+        goto end;
+
+    if (failed && (mtrlj_negative.size + 1) * 2 > mtrlj_negative.capacity) {
+        struct mtrlj_negative_entry *old = mtrlj_negative.entries;
+        size_t old_capacity = mtrlj_negative.capacity;
+        size_t i;
+
+        mtrlj_negative.capacity = old_capacity ? old_capacity * 2 : 64;
+        mtrlj_negative.entries = calloc(mtrlj_negative.capacity,
+                                        sizeof(struct mtrlj_negative_entry));
+        for (i = 0; i < old_capacity; i++) {
+            if (old[i].tag != 0)
+                *mtrlj_negative_slot(old[i].tag) = old[i];
+        }
+        free(old);
+    }
+
+    entry = mtrlj_negative_slot(MTRLJ_PRODUCT_TAG(product, key));
+    if (failed) {
+        if (entry->tag == 0)
+            mtrlj_negative.size++;
+        entry->tag = MTRLJ_PRODUCT_TAG(product, key);
+        entry->until = (long)time(NULL) + mtrlj_negative.ttl;
+        entry->code = code;
+    } else if (entry->tag != 0) {
+        entry->until = 0; /* it works again */
+    }
+
+end:
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+}
+
+/* Shared memory cache. The segment is a header followed by a fixed size
+   open addressing table of records. Records are never removed, so a tag once
+   set stays. Readers don't lock, they retry if the sequence of the record
+   changed (or was odd, which means it is being written) while they copied it.
+   Writers take the record by making its sequence odd. A process may die
+   holding a record or the header, or before sizing the segment it created.
+   Whoever waits on it for longer than MTRLJ_SHARED_STUCK_SECONDS takes it
+   over. */
+
+#define MTRLJ_SHARED_MAGIC 0x6d74726cUL
+#define MTRLJ_SHARED_CLAIM_SECONDS 30
+#define MTRLJ_SHARED_STUCK_SECONDS 5
+
+struct mtrlj_shared_header {
+    volatile unsigned long magic; /* 1 while being initialized */
+    volatile unsigned long record_size;
+    volatile unsigned long capacity;
+};
+
+struct mtrlj_shared_record {
+    volatile unsigned long sequence;
+    volatile unsigned long tag;  /* product << 28 | key, 0 if empty */
+    volatile long claimed_until; /* someone is refreshing it until then */
+    long fetched;
+    size_t size;
+    union mtrlj_payload payload;
+};
+
+/* Guarded by mtrlj_shared_mapping. Getting and putting count as users, the
+   segment isn't unmapped while there are any. */
+static struct {
+    struct mtrlj_shared_header *header;
+    size_t mapped_size;
+    long max_age;
+    int users;
+} mtrlj_shared;
+
+static pthread_mutex_t mtrlj_shared_mapping = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mtrlj_shared_idle = PTHREAD_COND_INITIALIZER;
+
+/* Returns NULL if the cache isn't open, call mtrlj_shared_release
+   otherwise. */
+static struct mtrlj_shared_header *mtrlj_shared_acquire(long *max_age)
+{
+    struct mtrlj_shared_header *header;
+
+    pthread_mutex_lock(&mtrlj_shared_mapping);
+    header = mtrlj_shared.header;
+    if (header) {
+        mtrlj_shared.users++;
+        *max_age = mtrlj_shared.max_age;
+    }
+    pthread_mutex_unlock(&mtrlj_shared_mapping);
+
+    return header;
+}
+
+static void mtrlj_shared_release(void)
+{
+    pthread_mutex_lock(&mtrlj_shared_mapping);
+    if (--mtrlj_shared.users == 0)
+        pthread_cond_broadcast(&mtrlj_shared_idle);
+    pthread_mutex_unlock(&mtrlj_shared_mapping);
+}
+
+/* Unmaps the segment once nobody uses it, with mtrlj_shared_mapping held.
+   It is taken away first so that no new user comes meanwhile. */
+static void mtrlj_shared_unmap(void)
+{
+    struct mtrlj_shared_header *header;
+    size_t size;
+
+    while ((header = mtrlj_shared.header) != NULL) {
+        size = mtrlj_shared.mapped_size;
+        mtrlj_shared.header = NULL;
+        while (mtrlj_shared.users > 0)
+            pthread_cond_wait(&mtrlj_shared_idle, &mtrlj_shared_mapping);
+        munmap(header, size);
+    }
+}
+
+/* For spinning on a word held by another process, `spin` starts zeroed.
+   Returns 1 once the word kept the same `value` for too long. */
+struct mtrlj_shared_spin {
+    unsigned long value;
+    double since;
+};
+
+static int mtrlj_shared_stuck(struct mtrlj_shared_spin *spin,
+                              unsigned long value)
+{
+    if (spin->since == 0 || spin->value != value) {
+        spin->value = value;
+        spin->since = mtrlj_now();
+        return 0;
+    }
+
+    return mtrlj_now() - spin->since > MTRLJ_SHARED_STUCK_SECONDS;
+}
+
+/* Removes the segment `name` if it is still the one `st` is of. */
+static void mtrlj_shared_unlink_same(const char *name, const struct stat *st)
+{
+    struct stat current;
+    int fd = shm_open(name, O_RDONLY, 0600);
+
+    if (fd < 0)
+        return;
+    if (fstat(fd, &current) == 0 && current.st_dev == st->st_dev
+        && current.st_ino == st->st_ino)
+        shm_unlink(name);
+    close(fd);
+}
+
+MTRLJ_CODE mtrlj_shared_cache_open(const char *name, size_t capacity,
+                                   long max_age)
+{
+    struct mtrlj_shared_header *header;
+    struct mtrlj_shared_spin spin;
+    struct stat st;
+    void *memory;
+    size_t size;
+    int attempt;
+    int fd;
+
+    mtrlj_shared_cache_close();
+
+    for (attempt = 0;; attempt++) {
+        /* only the one creating it sizes it, someone truncating it to another
+           size could leave the mapping of another process past its end */
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            size = sizeof(struct mtrlj_shared_header)
+                   + capacity * sizeof(struct mtrlj_shared_record);
+            if (ftruncate(fd, size) != 0) {
+                close(fd);
+                shm_unlink(name);
+                return MTRLJ_NOT_AVAILABLE;
+            }
+            break;
+        }
+
+        fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0 && errno == ENOENT && attempt < 3)
+            continue; /* removed meanwhile, create it */
+        if (fd < 0)
+            return MTRLJ_NOT_AVAILABLE;
+
+        /* its creator may not have sized it yet */
+        spin.since = 0;
+        while (fstat(fd, &st) == 0 && st.st_size == 0
+               && !mtrlj_shared_stuck(&spin, 0))
+            mtrlj_sleep_ms(1);
+
+        if (fstat(fd, &st) != 0 || st.st_size != 0 || attempt >= 3)
+            break;
+
+        /* its creator died before sizing it, replace it unless someone
+           else already did */
+        mtrlj_shared_unlink_same(name, &st);
+        close(fd);
+    }
+
+    if (fstat(fd, &st) != 0
+        || (size_t)st.st_size < sizeof(struct mtrlj_shared_header)) {
+        close(fd);
+        return MTRLJ_NOT_AVAILABLE;
+    }
+
+    size = st.st_size;
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return MTRLJ_NOT_AVAILABLE;
+
+    header = (struct mtrlj_shared_header *)memory;
+    spin.since = 0;
+    while (!__sync_bool_compare_and_swap(&header->magic, 0, 1)) {
+        /* whoever initializes it writes the same, so if it died
+           initializing it the others can do it again */
+        if (header->magic != 1 || mtrlj_shared_stuck(&spin, 1))
+            break;
+        mtrlj_sleep_ms(1);
+    }
+
+    if (header->magic == 1) {
+        header->record_size = sizeof(struct mtrlj_shared_record);
+        header->capacity = (size - sizeof(struct mtrlj_shared_header))
+                           / sizeof(struct mtrlj_shared_record);
+        __sync_synchronize();
+        header->magic = MTRLJ_SHARED_MAGIC;
+    }
+
+    /* it may be made by a program with another layout */
+    if (header->magic != MTRLJ_SHARED_MAGIC
+        || header->record_size != sizeof(struct mtrlj_shared_record)
+        || header->capacity == 0) {
+        munmap(memory, size);
+        return MTRLJ_NOT_AVAILABLE;
+    }
+
+    /* another thread may have opened one meanwhile */
+    pthread_mutex_lock(&mtrlj_shared_mapping);
+    mtrlj_shared_unmap();
+    mtrlj_shared.header = header;
+    mtrlj_shared.mapped_size = size;
+    mtrlj_shared.max_age = max_age;
+    pthread_mutex_unlock(&mtrlj_shared_mapping);
+
+    return MTRLJ_OK;
+}
+
+void mtrlj_shared_cache_close(void)
+{
+    pthread_mutex_lock(&mtrlj_shared_mapping);
+    mtrlj_shared_unmap();
+    pthread_mutex_unlock(&mtrlj_shared_mapping);
+}
+
+/* Finds the record of `tag`, taking an empty one if there is none. */
+static struct mtrlj_shared_record *
+mtrlj_shared_record(struct mtrlj_shared_header *header, unsigned long tag)
+{
+    struct mtrlj_shared_record *records =
+        (struct mtrlj_shared_record *)(header + 1);
+    unsigned long capacity = header->capacity;
+    unsigned long i = (tag * 2654435761UL) % capacity;
+    unsigned long n;
+
+    for (n = 0; n < capacity; n++) {
+        struct mtrlj_shared_record *record = &records[i];
+
+        if (record->tag == tag
+            || (record->tag == 0
+                && __sync_bool_compare_and_swap(&record->tag, 0, tag))
+            || record->tag == tag)
+            return record;
+
+        i = (i + 1) % capacity;
+    }
+
+    return NULL;
+}
+
+/* Takes the record for writing and returns the sequence to publish it with.
+   A record left odd by a dead writer is taken from it. */
+static unsigned long mtrlj_shared_lock(struct mtrlj_shared_record *record)
+{
+    struct mtrlj_shared_spin spin = {0, 0};
+    unsigned long begin, owned;
+
+    for (;;) {
+        begin = record->sequence;
+        if (!(begin & 1))
+            owned = begin + 1;
+        else if (mtrlj_shared_stuck(&spin, begin))
+            owned = begin + 2;
+        else
+            continue;
+
+        if (__sync_bool_compare_and_swap(&record->sequence, begin, owned))
+            return owned + 1;
+    }
+}
+
+static int mtrlj_shared_read(struct mtrlj_shared_record *record, void *payload,
+                             size_t capacity, size_t *size, long *fetched)
+{
+    struct mtrlj_shared_spin spin = {0, 0};
+    unsigned long begin;
+
+    do {
+        while ((begin = record->sequence) & 1) {
+            if (mtrlj_shared_stuck(&spin, begin)) {
+                /* its writer died halfway, empty it */
+                if (__sync_bool_compare_and_swap(&record->sequence, begin,
+                                                 begin + 2)) {
+                    record->size = 0;
+                    __sync_synchronize();
+                    record->sequence = begin + 3;
+                }
+                *fetched = 0;
+                *size = 0;
+                return 0;
+            }
+        }
+        __sync_synchronize();
+
+        *fetched = record->fetched;
+        *size = record->size;
+        if (*size <= capacity)
+            memcpy(payload, &record->payload, *size);
+
+        __sync_synchronize();
+    } while (record->sequence != begin);
+
+    return *size != 0 && *size <= capacity;
+}
+
+static void mtrlj_shared_write(struct mtrlj_shared_record *record,
+                               const void *payload, size_t size)
+{
+    unsigned long end = mtrlj_shared_lock(record);
+
+    record->fetched = (long)time(NULL);
+    record->size = size;
+    memcpy(&record->payload, payload, size);
+
+    __sync_synchronize();
+    record->sequence = end;
+}
+
+/* Copies the record of (product, key) into `payload` and returns 1 if the
+   caller can use it. Otherwise the caller should fetch it and give the result
+   to mtrlj_shared_put, `claimed` tells if it is the one refreshing it. */
+static int mtrlj_shared_get(int product, int key, void *payload,
+                            size_t capacity, size_t *size, long *age,
+                            int *claimed)
+{
+    struct mtrlj_shared_header *header;
+    struct mtrlj_shared_record *record;
+    long fetched, now, claimed_until, max_age;
+    int have = 0;
+
+    *claimed = 0;
+    if (key <= 0 || (header = mtrlj_shared_acquire(&max_age)) == NULL)
+        return 0;
+
+    record = mtrlj_shared_record(header, MTRLJ_PRODUCT_TAG(product, key));
+    if (record == NULL)
+        goto end;
+
+    have = mtrlj_shared_read(record, payload, capacity, size, &fetched);
+    now = (long)time(NULL);
+    *age = now > fetched ? now - fetched : 0;
+
+    if (!have || *age >= max_age) {
+        claimed_until = record->claimed_until;
+        if (claimed_until <= now
+            && __sync_bool_compare_and_swap(&record->claimed_until,
+                                            claimed_until,
+                                            now + MTRLJ_SHARED_CLAIM_SECONDS)) {
+            *claimed = 1;
+            have = 0;
+            goto end;
+        }
+    }
+
+    /* if someone else is refreshing it, the old one is fine meanwhile */
+    if (have)
+        mtrlj_count(&mtrlj_transport.stats.shared_hits);
+
+end:
+    mtrlj_shared_release();
+    return have;
+}
+
+/* NULL `payload` only gives up the claim, fetching failed. */
+static void mtrlj_shared_put(int product, int key, const void *payload,
+                             size_t size, int claimed)
+{
+    struct mtrlj_shared_header *header;
+    struct mtrlj_shared_record *record;
+    long max_age;
+
+    if (key <= 0 || (header = mtrlj_shared_acquire(&max_age)) == NULL)
+        return;
+
+    record = mtrlj_shared_record(header, MTRLJ_PRODUCT_TAG(product, key));
+    if (record == NULL)
+        goto end;
+
+    if (payload)
+        mtrlj_shared_write(record, payload, size);
+
+    if (claimed) {
+        if (payload)
+            mtrlj_count(&mtrlj_transport.stats.shared_refresh);
+        record->claimed_until = 0;
+    }
+
+end:
+    mtrlj_shared_release();
+}
+
+static MTRLJ_CODE
+mtrlj_parse_latest_situation(const struct mtrlj_curl_response *mcp,
+                             struct mtrlj_situation *situation)
+{
+    MTRLJ_CODE return_code = MTRLJ_OK;
+    cJSON *situation_json = NULL;
+
+    situation_json = cJSON_Parse(mcp->response);
+    if (situation_json == NULL || !cJSON_IsArray(situation_json)
+        || cJSON_GetArraySize(situation_json) != 1) {
+        return_code = MTRLJ_JSON_PARSING_FAILED;
+        goto end;
+    }
+
+    {
+        cJSON *json = cJSON_GetArrayItem(situation_json, 0);
+        cJSON *actual_pressure = cJSON_GetObjectItem(json, "aktuelBasinc");
+        cJSON *reduced_pressure_at_sea =
+            cJSON_GetObjectItem(json, "denizeIndirgenmisBasinc");
+        cJSON *sea_temperature = cJSON_GetObjectItem(json, "denizSicaklik");
+        cJSON *condition_code = cJSON_GetObjectItem(json, "hadiseKodu");
+        cJSON *cloudiness_percent = cJSON_GetObjectItem(json, "kapalilik");
+        cJSON *snow_height = cJSON_GetObjectItem(json, "karYukseklik");
+        cJSON *humidity_percent = cJSON_GetObjectItem(json, "nem");
+        cJSON *wind_speed = cJSON_GetObjectItem(json, "ruzgarHiz");
+        cJSON *wind_direction = cJSON_GetObjectItem(json, "ruzgarYon");
+        cJSON *temperature = cJSON_GetObjectItem(json, "sicaklik");
+        cJSON *rainfall = cJSON_GetObjectItem(json, "yagis00Now");
+        cJSON *rainfall_10_mins = cJSON_GetObjectItem(json, "yagis10Dk");
+        cJSON *rainfall_1_hour = cJSON_GetObjectItem(json, "yagis1Saat");
+        cJSON *rainfall_6_hours = cJSON_GetObjectItem(json, "yagis6Saat");
+        cJSON *rainfall_12_hours = cJSON_GetObjectItem(json, "yagis12Saat");
+        cJSON *rainfall_24_hours = cJSON_GetObjectItem(json, "yagis24Saat");
+        cJSON *time = cJSON_GetObjectItem(json, "veriZamani");
+
+        /* this is a huge if statement lol */
+        if (!cJSON_IsNumber(actual_pressure)
+            || !cJSON_IsNumber(reduced_pressure_at_sea)
+            || !cJSON_IsNumber(sea_temperature)
+            || !cJSON_IsNumber(cloudiness_percent)
+            || !cJSON_IsNumber(snow_height) || !cJSON_IsNumber(humidity_percent)
+            || !cJSON_IsNumber(wind_speed) || !cJSON_IsNumber(wind_direction)
+            || !cJSON_IsNumber(temperature) || !cJSON_IsNumber(rainfall)
+            || !cJSON_IsNumber(rainfall_10_mins)
+            || !cJSON_IsNumber(rainfall_1_hour)
+            || !cJSON_IsNumber(rainfall_6_hours)
+            || !cJSON_IsNumber(rainfall_12_hours)
+            || !cJSON_IsNumber(rainfall_24_hours) || !cJSON_IsString(time)
+            || (time->valuestring == NULL) || !cJSON_IsString(condition_code)
+            || (condition_code->valuestring == NULL)) {
+            return_code = MTRLJ_JSON_PARSING_FAILED;
+            goto end;
+        }
+
+        situation->actual_pressure = actual_pressure->valuedouble;
+        situation->reduced_pressure_at_sea =
+            reduced_pressure_at_sea->valuedouble;
+        situation->sea_temperature = sea_temperature->valuedouble;
+        situation->condition =
+            mtrlj_condition_from_code(condition_code->valuestring);
+        situation->cloudiness_percent = cloudiness_percent->valuedouble;
+        situation->snow_height = snow_height->valuedouble;
+        situation->humidity_percent = humidity_percent->valuedouble;
+        situation->wind_speed = wind_speed->valuedouble;
+        situation->wind_direction = wind_direction->valuedouble;
+        situation->temperature = temperature->valuedouble;
+        situation->rainfall = rainfall->valuedouble;
+        situation->rainfall_10_mins = rainfall_10_mins->valuedouble;
+        situation->rainfall_1_hour = rainfall_1_hour->valuedouble;
+        situation->rainfall_6_hours = rainfall_6_hours->valuedouble;
+        situation->rainfall_12_hours = rainfall_12_hours->valuedouble;
+        situation->rainfall_24_hours = rainfall_24_hours->valuedouble;
+        situation->time = mtrlj_parse_iso8601_time(time->valuestring);
+        situation->age = mcp->age;
+
+        /* looks like mgm returns UTC time here? */
+        situation->time.hour += 3;
+    }
+
+end:
+    cJSON_Delete(situation_json);
+    return return_code;
+}
+
+static MTRLJ_CODE
+mtrlj_fetch_latest_situation(struct mtrlj_district district,
+                             struct mtrlj_situation *situation, long *status)
+{
+    char parameter[128];
+    const char *url_parameter = parameter;
+    MTRLJ_CODE return_code;
+    struct mtrlj_curl_response mcp = {0};
+
+    sprintf(parameter, "merkezid=%d", district.id);
+
+    if (!mtrlj_curl_get_params(LATEST_SITUATION_ENDPOINT, &url_parameter, 1,
+                               &mcp))
+        return_code = MTRLJ_REQUEST_FAILED;
+    else
+        return_code = mtrlj_parse_latest_situation(&mcp, situation);
+
+    *status = mcp.status;
+    free(mcp.response);
+    return return_code;
+}
+
+MTRLJ_CODE mtrlj_five_days_forecast(struct mtrlj_district district,
+                                    struct mtrlj_daily_forecast **forecasts)
+{
+    struct mtrlj_daily_forecast *result;
+    MTRLJ_CODE return_code;
+
+    if (district.daily_forecast_station == 0)
+        return MTRLJ_NOT_AVAILABLE;
+
+    result = calloc(5, sizeof(struct mtrlj_daily_forecast));
+    return_code = mtrlj_five_days_forecast_buf(district, result);
+    if (return_code != MTRLJ_OK) {
+        free(result);
+        return return_code;
+    }
+
+    *forecasts = result;
+    return MTRLJ_OK;
+}
+
+MTRLJ_CODE mtrlj_hourly_forecasts(struct mtrlj_district district,
+                                  struct mtrlj_hourly_forecast **forecasts,
+                                  size_t *size)
+{
+    struct mtrlj_hourly_forecast buffer[MTRLJ_HOURLY_FORECAST_MAX];
+    MTRLJ_CODE return_code;
+
+    return_code = mtrlj_hourly_forecasts_buf(district, buffer,
+                                             MTRLJ_HOURLY_FORECAST_MAX, size);
+    if (return_code == MTRLJ_OK) {
+        *forecasts = calloc(*size, sizeof(struct mtrlj_hourly_forecast));
+        memcpy(*forecasts, buffer,
+               *size * sizeof(struct mtrlj_hourly_forecast));
+    } else if (return_code == MTRLJ_BUFFER_TOO_SMALL) {
+        /* never seen MGM doing this, but just in case */
+        *forecasts = calloc(*size, sizeof(struct mtrlj_hourly_forecast));
+        return_code =
+            mtrlj_hourly_forecasts_buf(district, *forecasts, *size, size);
+        if (return_code != MTRLJ_OK)
+            free(*forecasts);
+    }
+
+    return return_code;
+}
+
+#ifndef METEOROLOJI_EMBED_CATALOG
+MTRLJ_CODE mtrlj_get_districts_in_city_buf(struct mtrlj_district *districts,
+                                           size_t capacity, size_t *size,
+                                           char *names, size_t names_capacity,
+                                           size_t *names_size,
+                                           const char *city_name)
+{
+    char parameter[128];
+    const char *url_parameter = parameter;
+    MTRLJ_CODE return_code = MTRLJ_OK;
+    struct mtrlj_curl_response mcp = {0};
+    cJSON *districts_json = NULL;
+    const cJSON *district_json = NULL;
+    size_t i;
+
+    sprintf(parameter, "il=%.100s", city_name);
+
+    if (!mtrlj_curl_get_params(DISTRICTS_ENDPOINT, &url_parameter, 1, &mcp)) {
+        return_code = MTRLJ_REQUEST_FAILED;
+        goto end;
+    }
+
+    districts_json = cJSON_Parse(mcp.response);
+    if (districts_json == NULL || !cJSON_IsArray(districts_json)) {
+        return_code = MTRLJ_JSON_PARSING_FAILED;
+        goto end;
+    }
+
+    *size = cJSON_GetArraySize(districts_json);
+    *names_size = 0;
+    if (*size > capacity)
+        return_code = MTRLJ_BUFFER_TOO_SMALL;
+
+    i = 0;
+    cJSON_ArrayForEach(district_json, districts_json)
+    {
+        struct mtrlj_district unused;
+        MTRLJ_CODE res = mtrlj_json_parse_district_buf(
+            district_json, i < capacity ? districts + i : &unused, names,
+            return_code == MTRLJ_OK ? names_capacity : 0, names_size);
+
+        if (res == MTRLJ_BUFFER_TOO_SMALL) {
+            /* keep going, we still want to report the needed size */
+            return_code = res;
+        } else if (res != MTRLJ_OK) {
+            return_code = res;
+            goto end;
+        }
+
+        i++;
+    }
+
+end:
+    cJSON_Delete(districts_json);
+    free(mcp.response);
+    return return_code;
+}
+
+#else
+MTRLJ_CODE mtrlj_get_districts_in_city_buf(struct mtrlj_district *districts,
+                                           size_t capacity, size_t *size,
+                                           char *names, size_t names_capacity,
+                                           size_t *names_size,
+                                           const char *city_name)
+{
+    const struct mtrlj_district *embedded;
+
+    (void)names;
+    (void)names_capacity;
+
+    embedded = mtrlj_embedded_city_districts(city_name, size);
+    if (embedded == NULL)
+        return MTRLJ_NOT_AVAILABLE;
+
+    /* names already live in read-only tables */
+    *names_size = 0;
+    if (*size > capacity)
+        return MTRLJ_BUFFER_TOO_SMALL;
+
+    memcpy(districts, embedded, *size * sizeof(struct mtrlj_district));
+    return MTRLJ_OK;
+}
+#endif
+
+static MTRLJ_CODE
+mtrlj_parse_five_days_forecast(const struct mtrlj_curl_response *mcp,
+                               struct mtrlj_daily_forecast *forecasts)
+{
+    MTRLJ_CODE return_code;
+    cJSON *daily_json = NULL;
+
+    daily_json = cJSON_Parse(mcp->response);
+    if (daily_json == NULL || !cJSON_IsArray(daily_json)
+        || cJSON_GetArraySize(daily_json) != 1)
+        return_code = MTRLJ_JSON_PARSING_FAILED;
+    else
+        return_code = mtrlj_json_parse_daily_forecasts(
+            cJSON_GetArrayItem(daily_json, 0), forecasts);
+
+    cJSON_Delete(daily_json);
+    return return_code;
+}
+
+static MTRLJ_CODE
+mtrlj_fetch_five_days_forecast(struct mtrlj_district district,
+                               struct mtrlj_daily_forecast *forecasts,
+                               long *status)
+{
+    char parameter[128];
+    const char *url_parameter = parameter;
+    MTRLJ_CODE return_code = MTRLJ_OK;
+    struct mtrlj_curl_response mcp = {0};
+    size_t i;
+
+    if (district.daily_forecast_station == 0)
+        return MTRLJ_NOT_AVAILABLE;
+
+    sprintf(parameter, "istno=%d", district.daily_forecast_station);
+
+    if (!mtrlj_curl_get_params(DAILY_FORECAST_ENDPOINT, &url_parameter, 1,
+                               &mcp)) {
+        return_code = MTRLJ_REQUEST_FAILED;
+        goto end;
+    }
+
+    return_code = mtrlj_parse_five_days_forecast(&mcp, forecasts);
+    if (return_code != MTRLJ_OK)
+        goto end;
+
+    for (i = 0; i < 5; i++) {
+        if (mtrlj_get_past_values(district.id, forecasts + i) != MTRLJ_OK)
+            mtrlj_past_values_unavailable(forecasts + i);
+    }
+
+end:
+    *status = mcp.status;
+    free(mcp.response);
+    return return_code;
+}
+
+static MTRLJ_CODE
+mtrlj_parse_hourly_forecasts(const struct mtrlj_curl_response *mcp,
+                             struct mtrlj_hourly_forecast *forecasts,
+                             size_t capacity, size_t *size)
+{
+    MTRLJ_CODE return_code = MTRLJ_OK;
+    cJSON *hourly_json = NULL;
+    cJSON *forecasts_json = NULL;
+    const cJSON *forecast_json = NULL;
+    size_t i;
+
+    hourly_json = cJSON_Parse(mcp->response);
+    if (hourly_json == NULL || !cJSON_IsArray(hourly_json)
+        || cJSON_GetArraySize(hourly_json) != 1) {
+        return_code = MTRLJ_JSON_PARSING_FAILED;
+        goto end;
+    }
+
+    forecasts_json =
+        cJSON_GetObjectItem(cJSON_GetArrayItem(hourly_json, 0), "tahmin");
+
+    if (forecasts_json == NULL || !cJSON_IsArray(forecasts_json)) {
+        return_code = MTRLJ_JSON_PARSING_FAILED;
+        goto end;
+    }
+
+    *size = cJSON_GetArraySize(forecasts_json);
+    if (*size > capacity) {
+        return_code = MTRLJ_BUFFER_TOO_SMALL;
+        goto end;
+    }
+
+    i = 0;
+    cJSON_ArrayForEach(forecast_json, forecasts_json)
+    {
+        MTRLJ_CODE res =
+            mtrlj_json_parse_hourly_forecast(forecast_json, forecasts + i);
+
+        if (res != MTRLJ_OK) {
+            return_code = res;
+            goto end;
+        }
+
+        forecasts[i].age = mcp->age;
+
+        i++;
+    }
+
+end:
+    cJSON_Delete(hourly_json);
+    return return_code;
+}
+
+static MTRLJ_CODE
+mtrlj_fetch_hourly_forecasts(struct mtrlj_district district,
+                             struct mtrlj_hourly_forecast *forecasts,
+                             size_t capacity, size_t *size, long *status)
+{
+    char parameter[128];
+    const char *url_parameter = parameter;
+    MTRLJ_CODE return_code;
+    struct mtrlj_curl_response mcp = {0};
+
+    if (district.hourly_forecast_station == 0)
+        return MTRLJ_NOT_AVAILABLE;
+
+    sprintf(parameter, "istno=%d", district.hourly_forecast_station);
+
+    if (!mtrlj_curl_get_params(HOURLY_FORECAST_ENDPOINT, &url_parameter, 1,
+                               &mcp))
+        return_code = MTRLJ_REQUEST_FAILED;
+    else
+        return_code =
+            mtrlj_parse_hourly_forecasts(&mcp, forecasts, capacity, size);
+
+    *status = mcp.status;
+    free(mcp.response);
+    return return_code;
+}
+
+/* These go through the negative and shared memory caches. */
+
+MTRLJ_CODE mtrlj_latest_situation(struct mtrlj_district district,
+                                  struct mtrlj_situation *situation)
+{
+    MTRLJ_CODE return_code;
+    size_t size;
+    long age, status = 0;
+    int claimed;
+
+    if (mtrlj_negative_get(MTRLJ_PRODUCT_SITUATION, district.id, &return_code))
+        return return_code;
+
+    if (mtrlj_shared_get(MTRLJ_PRODUCT_SITUATION, district.id, situation,
+                         sizeof(struct mtrlj_situation), &size, &age,
+                         &claimed)) {
+        situation->age = age;
+        return MTRLJ_OK;
+    }
+
+    return_code = mtrlj_fetch_latest_situation(district, situation, &status);
+    mtrlj_negative_put(MTRLJ_PRODUCT_SITUATION, district.id, return_code,
+                       status);
+    mtrlj_shared_put(MTRLJ_PRODUCT_SITUATION, district.id,
+                     return_code == MTRLJ_OK ? situation : NULL,
+                     sizeof(struct mtrlj_situation), claimed);
+    return return_code;
+}
+
+MTRLJ_CODE mtrlj_five_days_forecast_buf(struct mtrlj_district district,
+                                        struct mtrlj_daily_forecast *forecasts)
+{
+    MTRLJ_CODE return_code;
+    size_t size;
+    long age, status = 0;
+    int claimed;
+
+    if (district.daily_forecast_station == 0)
+        return MTRLJ_NOT_AVAILABLE;
+
+    /* keyed by district, the past values in it are the district's own */
+    if (mtrlj_negative_get(MTRLJ_PRODUCT_DAILY, district.id, &return_code))
+        return return_code;
+
+    if (mtrlj_shared_get(MTRLJ_PRODUCT_DAILY, district.id, forecasts,
+                         5 * sizeof(struct mtrlj_daily_forecast), &size, &age,
+                         &claimed))
+        return MTRLJ_OK;
+
+    mtrlj_call_begin();
+    return_code =
+        mtrlj_fetch_five_days_forecast(district, forecasts, &status);
+    mtrlj_call_end();
+    mtrlj_negative_put(MTRLJ_PRODUCT_DAILY, district.id, return_code, status);
+    mtrlj_shared_put(MTRLJ_PRODUCT_DAILY, district.id,
+                     return_code == MTRLJ_OK ? forecasts : NULL,
+                     5 * sizeof(struct mtrlj_daily_forecast), claimed);
+    return return_code;
+}
+
+MTRLJ_CODE mtrlj_hourly_forecasts_buf(struct mtrlj_district district,
+                                      struct mtrlj_hourly_forecast *forecasts,
+                                      size_t capacity, size_t *size)
+{
+    MTRLJ_CODE return_code;
+    size_t bytes, i;
+    long age, status = 0;
+    int claimed;
+
+    if (district.hourly_forecast_station == 0)
+        return MTRLJ_NOT_AVAILABLE;
+
+    if (mtrlj_negative_get(MTRLJ_PRODUCT_HOURLY,
+                           district.hourly_forecast_station, &return_code))
+        return return_code;
+
+    if (mtrlj_shared_get(MTRLJ_PRODUCT_HOURLY, district.hourly_forecast_station,
+                         forecasts,
+                         capacity * sizeof(struct mtrlj_hourly_forecast),
+                         &bytes, &age, &claimed)) {
+        *size = bytes / sizeof(struct mtrlj_hourly_forecast);
+        for (i = 0; i < *size; i++)
+            forecasts[i].age = age;
+        return MTRLJ_OK;
+    }
+
+    return_code = mtrlj_fetch_hourly_forecasts(district, forecasts, capacity,
+                                               size, &status);
+    mtrlj_negative_put(MTRLJ_PRODUCT_HOURLY, district.hourly_forecast_station,
+                       return_code, status);
+    bytes = return_code == MTRLJ_OK && *size <= MTRLJ_HOURLY_FORECAST_MAX
+                ? *size * sizeof(struct mtrlj_hourly_forecast)
+                : 0;
+    mtrlj_shared_put(MTRLJ_PRODUCT_HOURLY, district.hourly_forecast_station,
+                     bytes ? forecasts : NULL, bytes, claimed);
+    return return_code;
+}
+
+/* Thread pool. Each thread owns a deque of jobs, it takes from the back of
+   its own and steals from the front of others'. Jobs are dealt to deques
+   round robin. */
+
+struct mtrlj_job {
+    MTRLJ_SUBSCRIBE_PRODUCT product;
+    struct mtrlj_district district;
+    MTRLJ_PRIORITY priority;
+    void *result;
+    size_t capacity;
+    size_t *size;
+    MTRLJ_CODE code;
+    int done;
+};
+
+struct mtrlj_deque {
+    struct mtrlj_job **jobs;
+    size_t head, size, capacity;
+    pthread_mutex_t lock;
+};
+
+static struct {
+    size_t threads;
+    size_t created; /* threads that could be created */
+    size_t started; /* threads that know their index */
+    pthread_t *thread;
+    struct mtrlj_deque *deques;
+    size_t next;   /* deque for the next job from outside */
+    size_t queued; /* jobs in all deques */
+    int open;      /* taking jobs, all threads are running */
+    int stopping;
+} mtrlj_pool;
+
+/* The lock guards the fields above, the setup lock is held while starting
+   or stopping the pool. */
+static pthread_mutex_t mtrlj_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t mtrlj_pool_setup = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mtrlj_pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t mtrlj_pool_done = PTHREAD_COND_INITIALIZER;
+
+static void mtrlj_deque_push(struct mtrlj_deque *deque, struct mtrlj_job *job)
+{
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->size == deque->capacity) {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 16;
+        struct mtrlj_job **jobs = malloc(capacity * sizeof(*jobs));
+        size_t i;
+
+        for (i = 0; i < deque->size; i++)
+            jobs[i] = deque->jobs[(deque->head + i) % deque->capacity];
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+
+    deque->jobs[(deque->head + deque->size++) % deque->capacity] = job;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+/* From the back if `own`, from the front otherwise. */
+static struct mtrlj_job *mtrlj_deque_pop(struct mtrlj_deque *deque, int own)
+{
+    struct mtrlj_job *job = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+
+    if (deque->size > 0) {
+        if (own) {
+            job = deque->jobs[(deque->head + deque->size - 1)
+                              % deque->capacity];
+        } else {
+            job = deque->jobs[deque->head];
+            deque->head = (deque->head + 1) % deque->capacity;
+        }
+        deque->size--;
+    }
+
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+/* A job for pool thread `self`, its own or stolen. */
+static struct mtrlj_job *mtrlj_pool_take(struct mtrlj_deque *deques,
+                                         size_t threads, size_t self)
+{
+    struct mtrlj_job *job = mtrlj_deque_pop(deques + self, 1);
+    size_t i;
+
+    for (i = 1; job == NULL && i < threads; i++)
+        job = mtrlj_deque_pop(deques + (self + i) % threads, 0);
+
+    if (job) {
+        pthread_mutex_lock(&mtrlj_pool_lock);
+        mtrlj_pool.queued--;
+        pthread_mutex_unlock(&mtrlj_pool_lock);
+    }
+
+    return job;
+}
+
+static void mtrlj_job_run(struct mtrlj_job *job)
+{
+    struct mtrlj_call *call = mtrlj_call_state();
+    MTRLJ_PRIORITY priority = call->priority;
+
+    call->priority = job->priority;
+
+    switch (job->product) {
+    case MTRLJ_SUBSCRIBE_SITUATION:
+        job->code = mtrlj_latest_situation(job->district, job->result);
+        break;
+    case MTRLJ_SUBSCRIBE_FIVE_DAYS:
+        job->code = mtrlj_five_days_forecast_buf(job->district, job->result);
+        break;
+    case MTRLJ_SUBSCRIBE_HOURLY:
+        job->code = mtrlj_hourly_forecasts_buf(job->district, job->result,
+                                               job->capacity, job->size);
+        break;
+    }
+
+    call->priority = priority;
+
+    pthread_mutex_lock(&mtrlj_pool_lock);
+    job->done = 1;
+    pthread_cond_broadcast(&mtrlj_pool_done);
+    pthread_mutex_unlock(&mtrlj_pool_lock);
+}
+
+static void *mtrlj_pool_main(void *unused)
+{
+    struct mtrlj_deque *deques;
+    size_t threads, self;
+    (void)unused;
+
+    /* these stay until all pool threads are joined */
+    pthread_mutex_lock(&mtrlj_pool_lock);
+    self = mtrlj_pool.started++;
+    deques = mtrlj_pool.deques;
+    threads = mtrlj_pool.threads;
+    pthread_mutex_unlock(&mtrlj_pool_lock);
+
+    for (;;) {
+        struct mtrlj_job *job = mtrlj_pool_take(deques, threads, self);
+
+        if (job) {
+            mtrlj_job_run(job);
+            continue;
+        }
+
+        pthread_mutex_lock(&mtrlj_pool_lock);
+        while (mtrlj_pool.queued == 0 && !mtrlj_pool.stopping)
+            pthread_cond_wait(&mtrlj_pool_work, &mtrlj_pool_lock);
+        if (mtrlj_pool.queued == 0 && mtrlj_pool.stopping) {
+            pthread_mutex_unlock(&mtrlj_pool_lock);
+            break;
+        }
+        pthread_mutex_unlock(&mtrlj_pool_lock);
+    }
+
+    return NULL;
+}
+
+/* Finishes the queued jobs and frees the pool, with the setup lock held. */
+static void mtrlj_pool_stop(void)
+{
+    size_t i;
+
+    pthread_mutex_lock(&mtrlj_pool_lock);
+    mtrlj_pool.open = 0;
+    mtrlj_pool.stopping = 1;
+    pthread_cond_broadcast(&mtrlj_pool_work);
+    pthread_mutex_unlock(&mtrlj_pool_lock);
+
+    /* the others may still be stealing until they are all done */
+    for (i = 0; i < mtrlj_pool.created; i++)
+        pthread_join(mtrlj_pool.thread[i], NULL);
+
+    pthread_mutex_lock(&mtrlj_pool_lock);
+    for (i = 0; i < mtrlj_pool.threads; i++) {
+        free(mtrlj_pool.deques[i].jobs);
+        pthread_mutex_destroy(&mtrlj_pool.deques[i].lock);
+    }
+    free(mtrlj_pool.thread);
+    free(mtrlj_pool.deques);
+    memset(&mtrlj_pool, 0, sizeof(mtrlj_pool));
+    pthread_mutex_unlock(&mtrlj_pool_lock);
+}
+
+MTRLJ_CODE mtrlj_set_thread_pool(int threads)
+{
+    MTRLJ_CODE return_code = MTRLJ_OK;
+    size_t i;
+
+    pthread_mutex_lock(&mtrlj_pool_setup);
+
+    if (mtrlj_pool.threads)
+        mtrlj_pool_stop();
+
+    if (threads <= 0)
+        goto end;
+
+    mtrlj_curl_global_once();
+
+    /* deques are all there before any thread looks for work */
+    pthread_mutex_lock(&mtrlj_pool_lock);
+    mtrlj_pool.thread = calloc(threads, sizeof(pthread_t));
+    mtrlj_pool.deques = calloc(threads, sizeof(struct mtrlj_deque));
+    for (i = 0; i < (size_t)threads; i++)
+        pthread_mutex_init(&mtrlj_pool.deques[i].lock, NULL);
+    mtrlj_pool.threads = threads;
+    pthread_mutex_unlock(&mtrlj_pool_lock);
+
+    for (i = 0; i < (size_t)threads; i++) {
+        if (pthread_create(&mtrlj_pool.thread[i], NULL, mtrlj_pool_main,
+                           NULL)
+            != 0)
+            break;
+    }
+    mtrlj_pool.created = i;
+
+    /* no half pools, nothing was submitted to it yet */
+    if (i < (size_t)threads) {
+        mtrlj_pool_stop();
+        return_code = MTRLJ_REQUEST_FAILED;
+        goto end;
+    }
+
+    pthread_mutex_lock(&mtrlj_pool_lock);
+    mtrlj_pool.open = 1;
+    pthread_mutex_unlock(&mtrlj_pool_lock);
+
+end:
+    pthread_mutex_unlock(&mtrlj_pool_setup);
+    return return_code;
+}
+
+static struct mtrlj_job *mtrlj_submit(struct mtrlj_job *job)
+{
+    struct mtrlj_call *call = mtrlj_call_state();
+    size_t index;
+
+    job->priority = call->priority;
+
+    pthread_mutex_lock(&mtrlj_pool_lock);
+
+    if (!mtrlj_pool.open) {
+        pthread_mutex_unlock(&mtrlj_pool_lock);
+        mtrlj_job_run(job);
+        return job;
+    }
+
+    /* counted and pushed under the lock, so taking it never takes the count
+       below zero and the deques can't be freed meanwhile */
+    index = mtrlj_pool.next;
+    mtrlj_pool.next = (mtrlj_pool.next + 1) % mtrlj_pool.threads;
+    mtrlj_pool.queued++;
+    mtrlj_deque_push(mtrlj_pool.deques + index, job);
+    pthread_cond_signal(&mtrlj_pool_work);
+
+    pthread_mutex_unlock(&mtrlj_pool_lock);
+    return job;
+}
+
+struct mtrlj_job *
+mtrlj_submit_latest_situation(struct mtrlj_district district,
+                              struct mtrlj_situation *situation)
+{
+    struct mtrlj_job *job = calloc(1, sizeof(struct mtrlj_job));
+
+    job->product = MTRLJ_SUBSCRIBE_SITUATION;
+    job->district = district;
+    job->result = situation;
+    return mtrlj_submit(job);
+}
+
+struct mtrlj_job *
+mtrlj_submit_five_days_forecast(struct mtrlj_district district,
+                                struct mtrlj_daily_forecast *forecasts)
+{
+    struct mtrlj_job *job = calloc(1, sizeof(struct mtrlj_job));
+
+    job->product = MTRLJ_SUBSCRIBE_FIVE_DAYS;
+    job->district = district;
+    job->result = forecasts;
+    return mtrlj_submit(job);
+}
+
+struct mtrlj_job *
+mtrlj_submit_hourly_forecasts(struct mtrlj_district district,
+                              struct mtrlj_hourly_forecast *forecasts,
+                              size_t capacity, size_t *size)
+{
+    struct mtrlj_job *job = calloc(1, sizeof(struct mtrlj_job));
+
+    job->product = MTRLJ_SUBSCRIBE_HOURLY;
+    job->district = district;
+    job->result = forecasts;
+    job->capacity = capacity;
+    job->size = size;
+    return mtrlj_submit(job);
+}
+
+MTRLJ_CODE mtrlj_wait(struct mtrlj_job *job)
+{
+    MTRLJ_CODE return_code;
+
+    pthread_mutex_lock(&mtrlj_pool_lock);
+    while (!job->done)
+        pthread_cond_wait(&mtrlj_pool_done, &mtrlj_pool_lock);
+    pthread_mutex_unlock(&mtrlj_pool_lock);
+
+    return_code = job->code;
+    free(job);
+    return return_code;
+}
+
+/* Event loop. Transfers go through a curl multi handle driven by
+   curl_multi_socket_action, the same caches apply around them. */
+
+struct mtrlj_loop_transfer {
+    struct mtrlj_loop_transfer *next;
+    struct mtrlj_loop *loop;
+    CURL *curl;
+    CURLU *urlp;
+    struct curl_slist *headers;
+    char *full_url;
+    struct mtrlj_cache_entry entry;
+    int cached;
+    struct mtrlj_curl_response mcp;
+    void (*done)(struct mtrlj_loop_transfer *transfer, int ok);
+    void *data;
+};
+
+struct mtrlj_loop {
+    CURLM *multi;
+    mtrlj_watch_callback watch;
+    mtrlj_timer_callback timer;
+    void *ctx;
+    struct mtrlj_loop_transfer *transfers;
+    size_t pending;
+};
+
+static int mtrlj_loop_socket_callback(CURL *easy, curl_socket_t fd, int what,
+                                      void *data, void *socket_data)
+{
+    struct mtrlj_loop *loop = data;
+    int events = 0;
+    (void)easy;
+    (void)socket_data;
+
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT)
+        events |= MTRLJ_EVENT_IN;
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT)
+        events |= MTRLJ_EVENT_OUT;
+
+    loop->watch((int)fd, events, loop->ctx);
+    return 0;
+}
+
+static int mtrlj_loop_timer_callback(CURLM *multi, long milliseconds,
+                                     void *data)
+{
+    struct mtrlj_loop *loop = data;
+    (void)multi;
+
+    loop->timer(milliseconds, loop->ctx);
+    return 0;
+}
+
+struct mtrlj_loop *mtrlj_loop_new(mtrlj_watch_callback watch,
+                                  mtrlj_timer_callback timer, void *ctx)
+{
+    struct mtrlj_loop *loop = calloc(1, sizeof(struct mtrlj_loop));
+
+    mtrlj_curl_global_once();
+
+    loop->multi = curl_multi_init();
+    loop->watch = watch;
+    loop->timer = timer;
+    loop->ctx = ctx;
+
+    curl_multi_setopt(loop->multi, CURLMOPT_SOCKETFUNCTION,
+                      mtrlj_loop_socket_callback);
+    curl_multi_setopt(loop->multi, CURLMOPT_SOCKETDATA, loop);
+    curl_multi_setopt(loop->multi, CURLMOPT_TIMERFUNCTION,
+                      mtrlj_loop_timer_callback);
+    curl_multi_setopt(loop->multi, CURLMOPT_TIMERDATA, loop);
+
+    return loop;
+}
+
+static void mtrlj_loop_transfer_free(struct mtrlj_loop_transfer *transfer)
+{
+    if (transfer->curl)
+        curl_easy_cleanup(transfer->curl);
+    curl_slist_free_all(transfer->headers);
+    curl_url_cleanup(transfer->urlp);
+    curl_free(transfer->full_url);
+    free(transfer->entry.body);
+    free(transfer->mcp.response);
+    free(transfer);
+}
+
+/* Takes `transfer` off the loop, the multi handle included. */
+static void mtrlj_loop_unlink(struct mtrlj_loop_transfer *transfer)
+{
+    struct mtrlj_loop_transfer **link = &transfer->loop->transfers;
+
+    while (*link != transfer)
+        link = &(*link)->next;
+    *link = transfer->next;
+    transfer->loop->pending--;
+
+    curl_multi_remove_handle(transfer->loop->multi, transfer->curl);
+}
+
+/* Finishes the transfers curl is done with. */
+static void mtrlj_loop_check(struct mtrlj_loop *loop)
+{
+    CURLMsg *msg;
+    int queued;
+
+    while ((msg = curl_multi_info_read(loop->multi, &queued)) != NULL) {
+        struct mtrlj_loop_transfer *transfer;
+        CURLcode res = msg->data.result;
+        int ok;
+
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+                          (char **)&transfer);
+        mtrlj_loop_unlink(transfer);
+
+        mtrlj_count(&mtrlj_transport.stats.requests);
+        if (res == CURLE_OK)
+            curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE,
+                              &transfer->mcp.status);
+        else if (res == CURLE_OPERATION_TIMEDOUT)
+            mtrlj_count(&mtrlj_transport.stats.timeouts);
+
+        ok = mtrlj_cache_store(transfer->urlp, transfer->full_url,
+                               &transfer->entry, transfer->cached, res,
+                               &transfer->mcp);
+        transfer->done(transfer, ok);
+        mtrlj_loop_transfer_free(transfer);
+    }
+}
+
+void mtrlj_loop_socket_ready(struct mtrlj_loop *loop, int fd, int events)
+{
+    int flags = 0;
+    int running;
+
+    if (events & MTRLJ_EVENT_IN)
+        flags |= CURL_CSELECT_IN;
+    if (events & MTRLJ_EVENT_OUT)
+        flags |= CURL_CSELECT_OUT;
+    if (events & MTRLJ_EVENT_ERROR)
+        flags |= CURL_CSELECT_ERR;
+
+    curl_multi_socket_action(loop->multi, (curl_socket_t)fd, flags, &running);
+    mtrlj_loop_check(loop);
+}
+
+void mtrlj_loop_timeout(struct mtrlj_loop *loop)
+{
+    int running;
+
+    curl_multi_socket_action(loop->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    mtrlj_loop_check(loop);
+}
+
+size_t mtrlj_loop_pending(const struct mtrlj_loop *loop)
+{
+    return loop->pending;
+}
+
+/* Asks for `url` with `params` on `loop`, `done` gets called once with the
+   transfer, right away if it could be answered from caches. Returns 0 if it
+   couldn't be started, then `done` isn't called. */
+static int mtrlj_loop_get(struct mtrlj_loop *loop, const char *url,
+                          const char **params, size_t param_count,
+                          void (*done)(struct mtrlj_loop_transfer *, int),
+                          void *data)
+{
+    struct mtrlj_loop_transfer *transfer;
+    struct mtrlj_timing timing = mtrlj_timing_copy();
+    long transfer_timeout = timing.transfer;
+
+    transfer = calloc(1, sizeof(struct mtrlj_loop_transfer));
+    transfer->loop = loop;
+    transfer->done = done;
+    transfer->data = data;
+
+    transfer->urlp = mtrlj_url(url, params, param_count);
+    if (!transfer->urlp) {
+        free(transfer);
+        return 0;
+    }
+
+    if (mtrlj_cache_lookup(transfer->urlp, &transfer->full_url,
+                           &transfer->entry, &transfer->cached,
+                           &transfer->mcp)) {
+        done(transfer, 1);
+        mtrlj_loop_transfer_free(transfer);
+        return 1;
+    }
+
+    if (!mtrlj_breaker_allow(transfer->urlp)) {
+        done(transfer, mtrlj_cache_fallback(&transfer->entry,
+                                            transfer->cached,
+                                            &transfer->mcp));
+        mtrlj_loop_transfer_free(transfer);
+        return 1;
+    }
+
+    /* a loop call is a single transfer */
+    if (timing.call > 0
+        && (transfer_timeout <= 0 || timing.call < transfer_timeout))
+        transfer_timeout = timing.call;
+
+    transfer->headers =
+        mtrlj_request_headers(transfer->cached ? &transfer->entry : NULL);
+    transfer->curl = mtrlj_curl_easy(transfer->urlp, transfer->headers,
+                                     transfer_timeout, &transfer->mcp);
+    if (!transfer->curl) {
+        mtrlj_loop_transfer_free(transfer);
+        return 0;
+    }
+    curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, (void *)transfer);
+
+    transfer->next = loop->transfers;
+    loop->transfers = transfer;
+    loop->pending++;
+    curl_multi_add_handle(loop->multi, transfer->curl);
+
+    return 1;
+}
+
+/* What a loop request needs once its transfer is done. */
+struct mtrlj_loop_request {
+    struct mtrlj_update update;
+    int claimed;
+    mtrlj_loop_callback callback;
+    void *ctx;
+};
+
+static void mtrlj_loop_situation_done(struct mtrlj_loop_transfer *transfer,
+                                      int ok)
+{
+    struct mtrlj_loop_request *request = transfer->data;
+    struct mtrlj_situation situation;
+    int id = request->update.district.id;
+    MTRLJ_CODE return_code = MTRLJ_REQUEST_FAILED;
+
+    if (ok)
+        return_code =
+            mtrlj_parse_latest_situation(&transfer->mcp, &situation);
+
+    mtrlj_negative_put(MTRLJ_PRODUCT_SITUATION, id, return_code,
+                       transfer->mcp.status);
+    mtrlj_shared_put(MTRLJ_PRODUCT_SITUATION, id,
+                     return_code == MTRLJ_OK ? &situation : NULL,
+                     sizeof(struct mtrlj_situation), request->claimed);
+
+    if (return_code == MTRLJ_OK)
+        request->update.situation = &situation;
+    request->callback(return_code, &request->update, request->ctx);
+    free(request);
+}
+
+MTRLJ_CODE mtrlj_loop_latest_situation(struct mtrlj_loop *loop,
+                                       struct mtrlj_district district,
+                                       mtrlj_loop_callback callback,
+                                       void *ctx)
+{
+    struct mtrlj_loop_request *request;
+    struct mtrlj_situation situation;
+    char parameter[128];
+    const char *url_parameter = parameter;
+    MTRLJ_CODE return_code;
+    size_t size;
+    long age;
+
+    if (mtrlj_negative_get(MTRLJ_PRODUCT_SITUATION, district.id, &return_code))
+        return return_code;
+
+    request = calloc(1, sizeof(struct mtrlj_loop_request));
+    request->update.district = district;
+    request->update.product = MTRLJ_SUBSCRIBE_SITUATION;
+    request->callback = callback;
+    request->ctx = ctx;
+
+    if (mtrlj_shared_get(MTRLJ_PRODUCT_SITUATION, district.id, &situation,
+                         sizeof(struct mtrlj_situation), &size, &age,
+                         &request->claimed)) {
+        situation.age = age;
+        request->update.situation = &situation;
+        callback(MTRLJ_OK, &request->update, ctx);
+        free(request);
+        return MTRLJ_OK;
+    }
+
+    sprintf(parameter, "merkezid=%d", district.id);
+
+    if (!mtrlj_loop_get(loop, LATEST_SITUATION_ENDPOINT, &url_parameter, 1,
+                        mtrlj_loop_situation_done, request)) {
+        mtrlj_shared_put(MTRLJ_PRODUCT_SITUATION, district.id, NULL,
+                         sizeof(struct mtrlj_situation), request->claimed);
+        free(request);
+        return MTRLJ_REQUEST_FAILED;
+    }
+
+    return MTRLJ_OK;
+}
+
+static void mtrlj_loop_hourly_done(struct mtrlj_loop_transfer *transfer,
+                                   int ok)
+{
+    struct mtrlj_loop_request *request = transfer->data;
+    struct mtrlj_hourly_forecast buffer[MTRLJ_HOURLY_FORECAST_MAX];
+    struct mtrlj_hourly_forecast *forecasts = buffer;
+    int station = request->update.district.hourly_forecast_station;
+    MTRLJ_CODE return_code = MTRLJ_REQUEST_FAILED;
+    size_t size = 0, bytes;
+
+    if (ok) {
+        return_code = mtrlj_parse_hourly_forecasts(
+            &transfer->mcp, buffer, MTRLJ_HOURLY_FORECAST_MAX, &size);
+        if (return_code == MTRLJ_BUFFER_TOO_SMALL) {
+            forecasts = calloc(size, sizeof(struct mtrlj_hourly_forecast));
+            return_code = mtrlj_parse_hourly_forecasts(&transfer->mcp,
+                                                       forecasts, size, &size);
+        }
+    }
+
+    mtrlj_negative_put(MTRLJ_PRODUCT_HOURLY, station, return_code,
+                       transfer->mcp.status);
+    bytes = return_code == MTRLJ_OK && size <= MTRLJ_HOURLY_FORECAST_MAX
+                ? size * sizeof(struct mtrlj_hourly_forecast)
+                : 0;
+    mtrlj_shared_put(MTRLJ_PRODUCT_HOURLY, station, bytes ? forecasts : NULL,
+                     bytes, request->claimed);
+
+    if (return_code == MTRLJ_OK) {
+        request->update.hourly = forecasts;
+        request->update.hourly_size = size;
+    }
+    request->callback(return_code, &request->update, request->ctx);
+
+    if (forecasts != buffer)
+        free(forecasts);
+    free(request);
+}
+
+MTRLJ_CODE mtrlj_loop_hourly_forecasts(struct mtrlj_loop *loop,
+                                       struct mtrlj_district district,
+                                       mtrlj_loop_callback callback,
+                                       void *ctx)
+{
+    struct mtrlj_loop_request *request;
+    struct mtrlj_hourly_forecast forecasts[MTRLJ_HOURLY_FORECAST_MAX];
+    int station = district.hourly_forecast_station;
+    char parameter[128];
+    const char *url_parameter = parameter;
+    MTRLJ_CODE return_code;
+    size_t bytes, i;
+    long age;
+
+    if (station == 0)
+        return MTRLJ_NOT_AVAILABLE;
+
+    if (mtrlj_negative_get(MTRLJ_PRODUCT_HOURLY, station, &return_code))
+        return return_code;
+
+    request = calloc(1, sizeof(struct mtrlj_loop_request));
+    request->update.district = district;
+    request->update.product = MTRLJ_SUBSCRIBE_HOURLY;
+    request->callback = callback;
+    request->ctx = ctx;
+
+    if (mtrlj_shared_get(MTRLJ_PRODUCT_HOURLY, station, forecasts,
+                         sizeof(forecasts), &bytes, &age,
+                         &request->claimed)) {
+        request->update.hourly = forecasts;
+        request->update.hourly_size =
+            bytes / sizeof(struct mtrlj_hourly_forecast);
+        for (i = 0; i < request->update.hourly_size; i++)
+            forecasts[i].age = age;
+        callback(MTRLJ_OK, &request->update, ctx);
+        free(request);
+        return MTRLJ_OK;
+    }
+
+    sprintf(parameter, "istno=%d", station);
+
+    if (!mtrlj_loop_get(loop, HOURLY_FORECAST_ENDPOINT, &url_parameter, 1,
+                        mtrlj_loop_hourly_done, request)) {
+        mtrlj_shared_put(MTRLJ_PRODUCT_HOURLY, station, NULL, 0,
+                         request->claimed);
+        free(request);
+        return MTRLJ_REQUEST_FAILED;
+    }
+
+    return MTRLJ_OK;
+}
+
+/* Resumable operations. Every request an op sends carries a part, telling
+   which op and which slot of its results it is for. An op freed with
+   requests on their way is freed by the last of them. */
+
+#define MTRLJ_OP_CATALOG_PARALLEL 8
+
+typedef enum {
+    MTRLJ_OP_FIVE_DAYS = 0,
+    MTRLJ_OP_CATALOG
+} MTRLJ_OP_KIND;
+
+typedef enum {
+    MTRLJ_OP_START = 0,
+    MTRLJ_OP_DAILY,
+    MTRLJ_OP_PAST_VALUES,
+    MTRLJ_OP_CITIES,
+    MTRLJ_OP_DISTRICTS,
+    MTRLJ_OP_FINISHED
+} MTRLJ_OP_STEP;
+
+struct mtrlj_op_city {
+    struct mtrlj_district *districts;
+    size_t size;
+    MTRLJ_CODE code;
+};
+
+struct mtrlj_op {
+    struct mtrlj_loop *loop;
+    MTRLJ_OP_KIND kind;
+    MTRLJ_OP_STEP step;
+    MTRLJ_CODE code;
+    int ready;
+    int orphaned;
+    size_t waiting; /* requests on their way */
+    void (*on_ready)(void *ctx);
+    void *ctx;
+
+    /* five days */
+    struct mtrlj_district district;
+    struct mtrlj_daily_forecast *forecasts;
+    long status;
+    int claimed;
+
+    /* catalog */
+    struct mtrlj_catalog *catalog;
+    struct mtrlj_district *cities;
+    size_t city_count;
+    struct mtrlj_op_city *city_results;
+    size_t next_city, cities_done;
+};
+
+struct mtrlj_op_part {
+    struct mtrlj_op *op;
+    size_t index;
+};
+
+static struct mtrlj_op *mtrlj_op_new(struct mtrlj_loop *loop,
+                                     MTRLJ_OP_KIND kind)
+{
+    struct mtrlj_op *op = calloc(1, sizeof(struct mtrlj_op));
+
+    op->loop = loop;
+    op->kind = kind;
+    op->ready = 1;
+    return op;
+}
+
+struct mtrlj_op *
+mtrlj_five_days_forecast_op(struct mtrlj_loop *loop,
+                            struct mtrlj_district district,
+                            struct mtrlj_daily_forecast *forecasts)
+{
+    struct mtrlj_op *op = mtrlj_op_new(loop, MTRLJ_OP_FIVE_DAYS);
+
+    op->district = district;
+    op->forecasts = forecasts;
+    return op;
+}
+
+struct mtrlj_op *mtrlj_catalog_load_op(struct mtrlj_loop *loop,
+                                       struct mtrlj_catalog *catalog)
+{
+    struct mtrlj_op *op = mtrlj_op_new(loop, MTRLJ_OP_CATALOG);
+
+    op->catalog = catalog;
+    return op;
+}
+
+void mtrlj_op_on_ready(struct mtrlj_op *op, void (*ready)(void *ctx),
+                       void *ctx)
+{
+    op->on_ready = ready;
+    op->ctx = ctx;
+}
+
+MTRLJ_OP_STATE mtrlj_op_poll(const struct mtrlj_op *op, MTRLJ_CODE *code)
+{
+    if (op->step == MTRLJ_OP_FINISHED) {
+        *code = op->code;
+        return MTRLJ_OP_DONE;
+    }
+
+    return op->ready ? MTRLJ_OP_READY : MTRLJ_OP_PENDING;
+}
+
+static void mtrlj_op_release(struct mtrlj_op *op)
+{
+    size_t i;
+
+    /* let go before finishing, other callers and processes shouldn't wait
+       for the refresh it claimed */
+    if (op->kind == MTRLJ_OP_FIVE_DAYS && op->step != MTRLJ_OP_START
+        && op->step != MTRLJ_OP_FINISHED) {
+        mtrlj_negative_put(MTRLJ_PRODUCT_DAILY, op->district.id, op->code,
+                           op->status);
+        mtrlj_shared_put(MTRLJ_PRODUCT_DAILY, op->district.id, NULL, 0,
+                         op->claimed);
+    }
+
+    if (op->city_results) {
+        for (i = 0; i < op->city_count; i++)
+            mtrlj_free_ndistrict(op->city_results[i].districts,
+                                 op->city_results[i].size);
+    }
+    free(op->city_results);
+    mtrlj_free_ndistrict(op->cities, op->city_count);
+    free(op);
+}
+
+/* Sends a request for `op`, its answer goes to `done` with slot `index`.
+   Returns 0 if it couldn't be sent. */
+static int mtrlj_op_send(struct mtrlj_op *op, size_t index, const char *url,
+                         const char **params, size_t param_count,
+                         void (*done)(struct mtrlj_loop_transfer *, int))
+{
+    struct mtrlj_op_part *part = malloc(sizeof(struct mtrlj_op_part));
+
+    part->op = op;
+    part->index = index;
+    op->waiting++;
+
+    if (!mtrlj_loop_get(op->loop, url, params, param_count, done, part)) {
+        op->waiting--;
+        free(part);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Done callbacks of requests take their part with this. Returns the op if
+   it still wants the answer. */
+static struct mtrlj_op *mtrlj_op_received(struct mtrlj_op_part *part)
+{
+    struct mtrlj_op *op = part->op;
+
+    op->waiting--;
+    if (op->orphaned) {
+        if (op->waiting == 0)
+            mtrlj_op_release(op);
+        return NULL;
+    }
+
+    return op;
+}
+
+/* Lets the op's owner know it can be stepped. */
+static void mtrlj_op_wake(struct mtrlj_op *op)
+{
+    op->ready = 1;
+    if (op->on_ready)
+        op->on_ready(op->ctx);
+}
+
+static void mtrlj_op_finish(struct mtrlj_op *op, MTRLJ_CODE code)
+{
+    op->code = code;
+    op->step = MTRLJ_OP_FINISHED;
+}
+
+static void mtrlj_op_daily_done(struct mtrlj_loop_transfer *transfer, int ok)
+{
+    struct mtrlj_op_part *part = transfer->data;
+    struct mtrlj_op *op = part->op;
+    struct mtrlj_daily_forecast unused[5];
+
+    /* the negative cache wants to know how it went even if the op was let
+       go, its forecasts may be gone by then */
+    op->status = transfer->mcp.status;
+    op->code = ok ? mtrlj_parse_five_days_forecast(
+                        &transfer->mcp, op->orphaned ? unused : op->forecasts)
+                  : MTRLJ_REQUEST_FAILED;
+
+    op = mtrlj_op_received(part);
+    if (op)
+        mtrlj_op_wake(op);
+    free(part);
+}
+
+static void mtrlj_op_past_values_done(struct mtrlj_loop_transfer *transfer,
+                                      int ok)
+{
+    struct mtrlj_op_part *part = transfer->data;
+    struct mtrlj_op *op = mtrlj_op_received(part);
+
+    if (op) {
+        struct mtrlj_daily_forecast *forecast = op->forecasts + part->index;
+
+        if (!ok || mtrlj_parse_past_values(&transfer->mcp, forecast)
+                       != MTRLJ_OK)
+            mtrlj_past_values_unavailable(forecast);
+        if (op->waiting == 0)
+            mtrlj_op_wake(op);
+    }
+    free(part);
+}
+
+/* Ends it like mtrlj_five_days_forecast_buf would, caches included. */
+static void mtrlj_op_five_days_finish(struct mtrlj_op *op, MTRLJ_CODE code)
+{
+    int id = op->district.id;
+
+    mtrlj_negative_put(MTRLJ_PRODUCT_DAILY, id, code, op->status);
+    mtrlj_shared_put(MTRLJ_PRODUCT_DAILY, id,
+                     code == MTRLJ_OK ? op->forecasts : NULL,
+                     5 * sizeof(struct mtrlj_daily_forecast), op->claimed);
+    mtrlj_op_finish(op, code);
+}
+
+static void mtrlj_op_five_days_step(struct mtrlj_op *op)
+{
+    int station = op->district.daily_forecast_station;
+    char parameters[5][3][128];
+    const char *url_parameters[5][3];
+    MTRLJ_CODE code;
+    size_t size, i;
+    long age;
+
+    switch (op->step) {
+    case MTRLJ_OP_START:
+        if (station == 0) {
+            mtrlj_op_finish(op, MTRLJ_NOT_AVAILABLE);
+            break;
+        }
+        if (mtrlj_negative_get(MTRLJ_PRODUCT_DAILY, op->district.id, &code)) {
+            mtrlj_op_finish(op, code);
+            break;
+        }
+        if (mtrlj_shared_get(MTRLJ_PRODUCT_DAILY, op->district.id,
+                             op->forecasts,
+                             5 * sizeof(struct mtrlj_daily_forecast), &size,
+                             &age, &op->claimed)) {
+            mtrlj_op_finish(op, MTRLJ_OK);
+            break;
+        }
+
+        sprintf(parameters[0][0], "istno=%d", station);
+        url_parameters[0][0] = parameters[0][0];
+        op->step = MTRLJ_OP_DAILY;
+        if (!mtrlj_op_send(op, 0, DAILY_FORECAST_ENDPOINT, url_parameters[0],
+                           1, mtrlj_op_daily_done))
+            mtrlj_op_five_days_finish(op, MTRLJ_REQUEST_FAILED);
+        break;
+
+    case MTRLJ_OP_DAILY:
+        if (op->waiting > 0)
+            break;
+        if (op->code != MTRLJ_OK) {
+            mtrlj_op_five_days_finish(op, op->code);
+            break;
+        }
+
+        op->step = MTRLJ_OP_PAST_VALUES;
+        for (i = 0; i < 5; i++) {
+            mtrlj_past_values_parameters(op->district.id, op->forecasts + i,
+                                         parameters[i], url_parameters[i]);
+            if (!mtrlj_op_send(op, i, PAST_VALUES_ENDPOINT,
+                               url_parameters[i], 3,
+                               mtrlj_op_past_values_done))
+                mtrlj_past_values_unavailable(op->forecasts + i);
+        }
+        if (op->waiting == 0) /* none of them could be sent */
+            mtrlj_op_five_days_finish(op, MTRLJ_OK);
+        break;
+
+    case MTRLJ_OP_PAST_VALUES:
+        if (op->waiting == 0)
+            mtrlj_op_five_days_finish(op, MTRLJ_OK);
+        break;
+
+    default:
+        break;
+    }
+}
+
+#ifndef METEOROLOJI_EMBED_CATALOG
+static void mtrlj_op_cities_done(struct mtrlj_loop_transfer *transfer, int ok)
+{
+    struct mtrlj_op_part *part = transfer->data;
+    struct mtrlj_op *op = mtrlj_op_received(part);
+
+    if (op) {
+        op->code = ok ? mtrlj_parse_districts(&transfer->mcp, &op->cities,
+                                              &op->city_count)
+                      : MTRLJ_REQUEST_FAILED;
+        mtrlj_op_wake(op);
+    }
+    free(part);
+}
+
+static void mtrlj_op_districts_done(struct mtrlj_loop_transfer *transfer,
+                                    int ok)
+{
+    struct mtrlj_op_part *part = transfer->data;
+    struct mtrlj_op *op = mtrlj_op_received(part);
+
+    if (op) {
+        struct mtrlj_op_city *city = op->city_results + part->index;
+
+        city->code = ok ? mtrlj_parse_districts(&transfer->mcp,
+                                                &city->districts, &city->size)
+                        : MTRLJ_REQUEST_FAILED;
+        op->cities_done++;
+        mtrlj_op_wake(op);
+    }
+    free(part);
+}
+
+/* Districts of all cities in city order, like mtrlj_catalog_load does. */
+static void mtrlj_op_catalog_finish(struct mtrlj_op *op)
+{
+    struct mtrlj_district *districts = NULL;
+    size_t size = 0;
+    size_t i;
+
+    for (i = 0; i < op->city_count; i++) {
+        if (op->city_results[i].code != MTRLJ_OK) {
+            mtrlj_op_finish(op, op->city_results[i].code);
+            return;
+        }
+    }
+
+    for (i = 0; i < op->city_count; i++)
+        size += op->city_results[i].size;
+    districts = calloc(size ? size : 1, sizeof(struct mtrlj_district));
+
+    size = 0;
+    for (i = 0; i < op->city_count; i++) {
+        memcpy(districts + size, op->city_results[i].districts,
+               op->city_results[i].size * sizeof(struct mtrlj_district));
+        size += op->city_results[i].size;
+        free(op->city_results[i].districts); /* names are moved */
+        op->city_results[i].districts = NULL;
+        op->city_results[i].size = 0;
+    }
+
+    mtrlj_catalog_init(op->catalog, op->cities, op->city_count, districts,
+                       size);
+    op->cities = NULL;
+    op->city_count = 0;
+    mtrlj_op_finish(op, MTRLJ_OK);
+}
+
+static void mtrlj_op_catalog_step(struct mtrlj_op *op)
+{
+    char parameter[128];
+    const char *url_parameter = parameter;
+
+    switch (op->step) {
+    case MTRLJ_OP_START:
+        op->step = MTRLJ_OP_CITIES;
+        if (!mtrlj_op_send(op, 0, CITIES_ENDPOINT, NULL, 0,
+                           mtrlj_op_cities_done))
+            mtrlj_op_finish(op, MTRLJ_REQUEST_FAILED);
+        break;
+
+    case MTRLJ_OP_CITIES:
+        if (op->waiting > 0)
+            break;
+        if (op->code != MTRLJ_OK) {
+            mtrlj_op_finish(op, op->code);
+            break;
+        }
+
+        op->step = MTRLJ_OP_DISTRICTS;
+        op->city_results =
+            calloc(op->city_count ? op->city_count : 1,
+                   sizeof(struct mtrlj_op_city));
+        /* fall through */
+
+    case MTRLJ_OP_DISTRICTS:
+        while (op->next_city < op->city_count
+               && op->waiting < MTRLJ_OP_CATALOG_PARALLEL) {
+            size_t i = op->next_city++;
+
+            sprintf(parameter, "il=%.100s", op->cities[i].city_name);
+            if (!mtrlj_op_send(op, i, DISTRICTS_ENDPOINT, &url_parameter, 1,
+                               mtrlj_op_districts_done)) {
+                op->city_results[i].code = MTRLJ_REQUEST_FAILED;
+                op->cities_done++;
+            }
+        }
+
+        if (op->cities_done == op->city_count)
+            mtrlj_op_catalog_finish(op);
+        break;
+
+    default:
+        break;
+    }
+}
+#else
+static void mtrlj_op_catalog_step(struct mtrlj_op *op)
+{
+    /* nothing to ask for, it is all in the tables */
+    mtrlj_op_finish(op, mtrlj_catalog_load(op->catalog));
+}
+#endif
+
+MTRLJ_OP_STATE mtrlj_op_step(struct mtrlj_op *op)
+{
+    /* requests answered from caches finish while being sent, go on until
+       there is something to wait for */
+    while (op->ready && op->step != MTRLJ_OP_FINISHED) {
+        op->ready = 0;
+        if (op->kind == MTRLJ_OP_FIVE_DAYS)
+            mtrlj_op_five_days_step(op);
+        else
+            mtrlj_op_catalog_step(op);
+    }
+
+    return op->step == MTRLJ_OP_FINISHED ? MTRLJ_OP_DONE : MTRLJ_OP_PENDING;
+}
+
+/* Columns */
+
+static int mtrlj_value_available(double value)
+{
+    return value != -99 && value != -9999;
+}
+
+/* Grows a column set to hold at least `capacity` rows, columns are described
+   with `values` and `valid` arrays of `field_count` elements. */
+static void mtrlj_columns_reserve(size_t *current, size_t capacity,
+                                  int **district_id,
+                                  MTRLJ_WEATHER_CONDITION **condition,
+                                  struct mtrlj_time **time, double **values,
+                                  unsigned char **valid, size_t field_count)
+{
+    size_t old_bytes = (*current + 7) / 8;
+    size_t new_bytes = (capacity + 7) / 8;
+    size_t i;
+
+    if (capacity <= *current)
+        return;
+
+    *district_id = realloc(*district_id, capacity * sizeof(int));
+    *condition =
+        realloc(*condition, capacity * sizeof(MTRLJ_WEATHER_CONDITION));
+    *time = realloc(*time, capacity * sizeof(struct mtrlj_time));
+
+    for (i = 0; i < field_count; i++) {
+        values[i] = realloc(values[i], capacity * sizeof(double));
+        valid[i] = realloc(valid[i], new_bytes);
+        memset(valid[i] + old_bytes, 0, new_bytes - old_bytes);
+    }
+
+    *current = capacity;
+}
+
+static void mtrlj_columns_set(double *values, unsigned char *valid, size_t row,
+                              double value)
+{
+    values[row] = value;
+    if (mtrlj_value_available(value))
+        valid[row >> 3] |= (unsigned char)(1 << (row & 7));
+    else
+        valid[row >> 3] &= (unsigned char)~(1 << (row & 7));
+}
+
+void mtrlj_situation_columns_init(struct mtrlj_situation_columns *columns,
+                                  size_t capacity)
+{
+    memset(columns, 0, sizeof(*columns));
+    mtrlj_columns_reserve(&columns->capacity, capacity < 8 ? 8 : capacity,
+                          &columns->district_id, &columns->condition,
+                          &columns->time, columns->values, columns->valid,
+                          MTRLJ_SITUATION_FIELD_COUNT);
+}
+
+/* Values of a situation in MTRLJ_SITUATION_FIELD order. */
+static void mtrlj_situation_fields(const struct mtrlj_situation *situation,
+                                   double *fields)
+{
+    fields[MTRLJ_SITUATION_ACTUAL_PRESSURE] = situation->actual_pressure;
+    fields[MTRLJ_SITUATION_REDUCED_PRESSURE_AT_SEA] =
+        situation->reduced_pressure_at_sea;
+    fields[MTRLJ_SITUATION_SEA_TEMPERATURE] = situation->sea_temperature;
+    fields[MTRLJ_SITUATION_SNOW_HEIGHT] = situation->snow_height;
+    fields[MTRLJ_SITUATION_HUMIDITY_PERCENT] = situation->humidity_percent;
+    fields[MTRLJ_SITUATION_WIND_SPEED] = situation->wind_speed;
+    fields[MTRLJ_SITUATION_WIND_DIRECTION] = situation->wind_direction;
+    fields[MTRLJ_SITUATION_CLOUDINESS_PERCENT] = situation->cloudiness_percent;
+    fields[MTRLJ_SITUATION_TEMPERATURE] = situation->temperature;
+    fields[MTRLJ_SITUATION_RAINFALL] = situation->rainfall;
+    fields[MTRLJ_SITUATION_RAINFALL_10_MINS] = situation->rainfall_10_mins;
+    fields[MTRLJ_SITUATION_RAINFALL_1_HOUR] = situation->rainfall_1_hour;
+    fields[MTRLJ_SITUATION_RAINFALL_6_HOURS] = situation->rainfall_6_hours;
+    fields[MTRLJ_SITUATION_RAINFALL_12_HOURS] = situation->rainfall_12_hours;
+    fields[MTRLJ_SITUATION_RAINFALL_24_HOURS] = situation->rainfall_24_hours;
+}
+
+void mtrlj_situation_columns_append(struct mtrlj_situation_columns *columns,
+                                    int district_id,
+                                    const struct mtrlj_situation *situation)
+{
+    double fields[MTRLJ_SITUATION_FIELD_COUNT];
+    size_t row = columns->size;
+    size_t i;
+
+    if (row == columns->capacity)
+        mtrlj_columns_reserve(&columns->capacity, row * 2 + 8,
+                              &columns->district_id, &columns->condition,
+                              &columns->time, columns->values,
+                              columns->valid, MTRLJ_SITUATION_FIELD_COUNT);
+
+    mtrlj_situation_fields(situation, fields);
+
+    columns->district_id[row] = district_id;
+    columns->condition[row] = situation->condition;
+    columns->time[row] = situation->time;
+    for (i = 0; i < MTRLJ_SITUATION_FIELD_COUNT; i++)
+        mtrlj_columns_set(columns->values[i], columns->valid[i], row,
+                          fields[i]);
+
+    columns->size++;
+}
+
+void mtrlj_hourly_forecast_columns_init(
+    struct mtrlj_hourly_forecast_columns *columns, size_t capacity)
+{
+    memset(columns, 0, sizeof(*columns));
+    mtrlj_columns_reserve(&columns->capacity, capacity < 8 ? 8 : capacity,
+                          &columns->district_id, &columns->condition,
+                          &columns->time, columns->values, columns->valid,
+                          MTRLJ_HOURLY_FIELD_COUNT);
+}
+
+void mtrlj_hourly_forecast_columns_append(
+    struct mtrlj_hourly_forecast_columns *columns, int district_id,
+    const struct mtrlj_hourly_forecast *forecast)
+{
+    double fields[MTRLJ_HOURLY_FIELD_COUNT];
+    size_t row = columns->size;
+    size_t i;
+
+    if (row == columns->capacity)
+        mtrlj_columns_reserve(&columns->capacity, row * 2 + 8,
+                              &columns->district_id, &columns->condition,
+                              &columns->time, columns->values,
+                              columns->valid, MTRLJ_HOURLY_FIELD_COUNT);
+
+    fields[MTRLJ_HOURLY_TEMPERATURE] = forecast->temperature;
+    fields[MTRLJ_HOURLY_FELT_TEMPERATURE] = forecast->felt_temperature;
+    fields[MTRLJ_HOURLY_HUMIDITY_PERCENT] = forecast->humidity_percent;
+    fields[MTRLJ_HOURLY_WIND_SPEED_AVG] = forecast->wind_speed_avg;
+    fields[MTRLJ_HOURLY_WIND_SPEED_MAX] = forecast->wind_speed_max;
+    fields[MTRLJ_HOURLY_WIND_DIRECTION] = forecast->wind_direction;
+
+    columns->district_id[row] = district_id;
+    columns->condition[row] = forecast->condition;
+    columns->time[row] = forecast->time;
+    for (i = 0; i < MTRLJ_HOURLY_FIELD_COUNT; i++)
+        mtrlj_columns_set(columns->values[i], columns->valid[i], row,
+                          fields[i]);
+
+    columns->size++;
+}
+
+/* Batch fetching. Worker threads take districts in order, but only `window`
+   of them may be fetching at once. The window is adjusted AIMD style, like
+   TCP's congestion window, by the time districts spend in transfers. Ones
+   answered from caches tell nothing about MGM and are left out. The best
+   latency is forgotten after a while so one lucky transfer doesn't hold
+   the window down forever. */
+
+#define MTRLJ_BATCH_MAX_THREADS 64
+#define MTRLJ_BATCH_BASELINE_SECONDS 10
+
+static struct {
+    int max;
+    double window;
+    double best_latency, best_at;
+    double decreased_at;
+    int in_flight;
+} mtrlj_aimd = {1, 1, 0, 0, 0, 0};
+
+static pthread_mutex_t mtrlj_aimd_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mtrlj_aimd_free = PTHREAD_COND_INITIALIZER;
+
+MTRLJ_CODE mtrlj_set_batch_concurrency(int max)
+{
+    pthread_mutex_lock(&mtrlj_aimd_lock);
+    mtrlj_aimd.max = max < 1 ? 1 : max > MTRLJ_BATCH_MAX_THREADS
+                                       ? MTRLJ_BATCH_MAX_THREADS
+                                       : max;
+    mtrlj_aimd.window = 1;
+    mtrlj_aimd.best_latency = 0;
+    pthread_mutex_unlock(&mtrlj_aimd_lock);
+
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    mtrlj_transport.stats.batch_window = 1;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+    return MTRLJ_OK;
+}
+
+static void mtrlj_aimd_acquire(void)
+{
+    pthread_mutex_lock(&mtrlj_aimd_lock);
+    while (mtrlj_aimd.in_flight >= (int)mtrlj_aimd.window)
+        pthread_cond_wait(&mtrlj_aimd_free, &mtrlj_aimd_lock);
+    mtrlj_aimd.in_flight++;
+    pthread_mutex_unlock(&mtrlj_aimd_lock);
+}
+
+/* `latency` is the time spent in transfers, 0 if there was none. */
+static void mtrlj_aimd_release(int failed, double latency)
+{
+    double now = mtrlj_now();
+
+    pthread_mutex_lock(&mtrlj_aimd_lock);
+    mtrlj_aimd.in_flight--;
+
+    if (latency <= 0)
+        goto end;
+
+    if (!failed
+        && (mtrlj_aimd.best_latency == 0 || latency < mtrlj_aimd.best_latency
+            || now - mtrlj_aimd.best_at > MTRLJ_BATCH_BASELINE_SECONDS)) {
+        mtrlj_aimd.best_latency = latency;
+        mtrlj_aimd.best_at = now;
+    }
+
+    if (failed || latency > 2 * mtrlj_aimd.best_latency) {
+        /* once per round trip, all in flight ones see the same trouble */
+        if (now - mtrlj_aimd.decreased_at > latency) {
+            mtrlj_aimd.window /= 2;
+            if (mtrlj_aimd.window < 1)
+                mtrlj_aimd.window = 1;
+            mtrlj_aimd.decreased_at = now;
+        }
+    } else {
+        mtrlj_aimd.window += 1 / mtrlj_aimd.window;
+        if (mtrlj_aimd.window > mtrlj_aimd.max)
+            mtrlj_aimd.window = mtrlj_aimd.max;
+    }
+
+    pthread_mutex_lock(&mtrlj_transport_lock);
+    mtrlj_transport.stats.batch_window = mtrlj_aimd.window;
+    pthread_mutex_unlock(&mtrlj_transport_lock);
+
+end:
+    pthread_cond_broadcast(&mtrlj_aimd_free);
+    pthread_mutex_unlock(&mtrlj_aimd_lock);
+}
+
+/* Batches are queued for the batch threads, which live until
+   mtrlj_shutdown. The caller works on its own batch too. */
+
+struct mtrlj_situation_batch {
+    const struct mtrlj_district *districts;
+    size_t size, next, done;
+    struct mtrlj_situation *situations;
+    MTRLJ_CODE *codes;
+    MTRLJ_PRIORITY priority;
+    double deadline; /* of the caller's call, 0 if none */
+    struct mtrlj_situation_batch *queued_next;
+};
+
+static struct {
+    pthread_t thread[MTRLJ_BATCH_MAX_THREADS - 1];
+    size_t threads;
+    struct mtrlj_situation_batch *queue;
+    int stopping;
+} mtrlj_batch;
+
+static pthread_mutex_t mtrlj_batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mtrlj_batch_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t mtrlj_batch_done = PTHREAD_COND_INITIALIZER;
+
+static void mtrlj_batch_unqueue(struct mtrlj_situation_batch *batch)
+{
+    struct mtrlj_situation_batch **p = &mtrlj_batch.queue;
+
+    while (*p && *p != batch)
+        p = &(*p)->queued_next;
+    if (*p)
+        *p = batch->queued_next;
+}
+
+/* Fetches districts of `batch` until none is left to take. Called and
+   returns with mtrlj_batch_lock held. */
+static void mtrlj_batch_run(struct mtrlj_situation_batch *batch)
+{
+    struct mtrlj_call *call = mtrlj_call_state();
+    struct mtrlj_call saved = *call;
+
+    /* the caller's priority and deadline hold for every district */
+    call->depth = 1;
+    call->deadline = batch->deadline;
+    call->priority = batch->priority;
+
+    while (batch->next < batch->size) {
+        size_t i = batch->next++;
+
+        if (batch->next == batch->size)
+            mtrlj_batch_unqueue(batch);
+        pthread_mutex_unlock(&mtrlj_batch_lock);
+
+        mtrlj_aimd_acquire();
+        call->transfer_time = 0;
+        batch->codes[i] =
+            mtrlj_latest_situation(batch->districts[i], &batch->situations[i]);
+        mtrlj_aimd_release(batch->codes[i] == MTRLJ_REQUEST_FAILED,
+                           call->transfer_time);
+
+        pthread_mutex_lock(&mtrlj_batch_lock);
+        if (++batch->done == batch->size)
+            pthread_cond_broadcast(&mtrlj_batch_done);
+    }
+
+    *call = saved;
+}
+
+static void *mtrlj_batch_main(void *unused)
+{
+    (void)unused;
+
+    pthread_mutex_lock(&mtrlj_batch_lock);
+    for (;;) {
+        while (mtrlj_batch.queue == NULL && !mtrlj_batch.stopping)
+            pthread_cond_wait(&mtrlj_batch_work, &mtrlj_batch_lock);
+        if (mtrlj_batch.queue == NULL)
+            break;
+        mtrlj_batch_run(mtrlj_batch.queue);
+    }
+    pthread_mutex_unlock(&mtrlj_batch_lock);
+
+    return NULL;
+}
+
+/* Makes sure there are `threads` batch threads, with mtrlj_batch_lock
+   held. */
+static void mtrlj_batch_grow(size_t threads)
+{
+    if (mtrlj_batch.threads == 0 && threads > 0)
+        mtrlj_curl_global_once();
+
+    while (mtrlj_batch.threads < threads
+           && pthread_create(&mtrlj_batch.thread[mtrlj_batch.threads], NULL,
+                             mtrlj_batch_main, NULL)
+                  == 0)
+        mtrlj_batch.threads++;
+}
+
+static void mtrlj_batch_stop(void)
+{
+    size_t i;
+
+    pthread_mutex_lock(&mtrlj_batch_lock);
+    mtrlj_batch.stopping = 1;
+    pthread_cond_broadcast(&mtrlj_batch_work);
+    pthread_mutex_unlock(&mtrlj_batch_lock);
+
+    for (i = 0; i < mtrlj_batch.threads; i++)
+        pthread_join(mtrlj_batch.thread[i], NULL);
+
+    memset(&mtrlj_batch, 0, sizeof(mtrlj_batch));
+}
+
+MTRLJ_CODE
+mtrlj_latest_situation_columns(const struct mtrlj_district *districts,
+                               size_t size,
+                               struct mtrlj_situation_columns *columns)
 {
-    const char *DISTRICT_ENDPOINT = "https://servis.mgm.gov.tr/web/merkezler";
-    char *url_parameters[2];
     MTRLJ_CODE return_code = MTRLJ_OK;
-    struct mtrlj_curl_response mcp = {0};
-    cJSON *district_json = NULL;
+    struct mtrlj_situation_batch batch;
+    size_t threads;
+    size_t i;
+
+    pthread_mutex_lock(&mtrlj_aimd_lock);
+    threads = mtrlj_aimd.max;
+    pthread_mutex_unlock(&mtrlj_aimd_lock);
+    if (threads > size)
+        threads = size;
+
+    mtrlj_call_begin();
+
+    memset(&batch, 0, sizeof(batch));
+    batch.districts = districts;
+    batch.size = size;
+    batch.situations = calloc(size ? size : 1, sizeof(struct mtrlj_situation));
+    batch.codes = calloc(size ? size : 1, sizeof(MTRLJ_CODE));
+    batch.priority = mtrlj_call_state()->priority;
+    batch.deadline = mtrlj_call_state()->deadline;
+
+    pthread_mutex_lock(&mtrlj_batch_lock);
+    if (threads > 1 && !mtrlj_batch.stopping) {
+        mtrlj_batch_grow(threads - 1);
+        batch.queued_next = mtrlj_batch.queue;
+        mtrlj_batch.queue = &batch;
+        pthread_cond_broadcast(&mtrlj_batch_work);
+    }
+    mtrlj_batch_run(&batch);
+    while (batch.done < batch.size)
+        pthread_cond_wait(&mtrlj_batch_done, &mtrlj_batch_lock);
+    pthread_mutex_unlock(&mtrlj_batch_lock);
+
+    mtrlj_call_end();
+
+    /* results are appended in the order of `districts` */
+    for (i = 0; i < size; i++) {
+        if (batch.codes[i] != MTRLJ_OK) {
+            if (return_code == MTRLJ_OK)
+                return_code = batch.codes[i];
+            continue;
+        }
+
+        mtrlj_situation_columns_append(columns, districts[i].id,
+                                       &batch.situations[i]);
+    }
+
+    free(batch.situations);
+    free(batch.codes);
+    return return_code;
+}
+
+MTRLJ_CODE
+mtrlj_hourly_forecasts_columns(struct mtrlj_district district,
+                               struct mtrlj_hourly_forecast_columns *columns)
+{
+    struct mtrlj_hourly_forecast *forecasts = NULL;
+    size_t size = 0;
+    size_t i;
+    MTRLJ_CODE res;
+
+    res = mtrlj_hourly_forecasts(district, &forecasts, &size);
+    if (res == MTRLJ_OK) {
+        for (i = 0; i < size; i++)
+            mtrlj_hourly_forecast_columns_append(columns, district.id,
+                                                 forecasts + i);
+    }
+
+    free(forecasts);
+    return res;
+}
+
+/* Aggregation kernels */
+
+static void mtrlj_aggregate_scalar(const double *values,
+                                   const unsigned char *valid, size_t begin,
+                                   size_t end, struct mtrlj_aggregate *agg)
+{
+    size_t i;
+
+    for (i = begin; i < end; i++) {
+        double value = values[i];
+
+        if (valid ? !MTRLJ_COLUMN_VALID(valid, i)
+                  : !mtrlj_value_available(value))
+            continue;
+
+        if (value < agg->min)
+            agg->min = value;
+        if (value > agg->max)
+            agg->max = value;
+        agg->sum += value;
+        agg->count++;
+    }
+}
+
+#ifdef MTRLJ_X86_SIMD
+/* All ones in the lanes of rows starting from `i` that have a value. */
+__attribute__((target("sse2"))) static __m128d
+mtrlj_mask_sse2(__m128d v, const unsigned char *valid, size_t i)
+{
+    if (valid) {
+        /* bit of each lane, twice since we compare 32 bit halves */
+        const __m128i lane_bits = _mm_set_epi32(2, 2, 1, 1);
+        int bits = (valid[i >> 3] >> (i & 7)) & 3;
+        __m128i b = _mm_and_si128(_mm_set1_epi32(bits), lane_bits);
+        return _mm_castsi128_pd(_mm_cmpeq_epi32(b, lane_bits));
+    }
+
+    return _mm_and_pd(_mm_cmpneq_pd(v, _mm_set1_pd(-99)),
+                      _mm_cmpneq_pd(v, _mm_set1_pd(-9999)));
+}
+
+__attribute__((target("avx2"))) static __m256d
+mtrlj_mask_avx2(__m256d v, const unsigned char *valid, size_t i)
+{
+    if (valid) {
+        const __m256i lane_bits = _mm256_set_epi64x(8, 4, 2, 1);
+        int bits = (valid[i >> 3] >> (i & 7)) & 15;
+        __m256i b = _mm256_and_si256(_mm256_set1_epi64x(bits), lane_bits);
+        return _mm256_castsi256_pd(_mm256_cmpeq_epi64(b, lane_bits));
+    }
+
+    return _mm256_and_pd(_mm256_cmp_pd(v, _mm256_set1_pd(-99), _CMP_NEQ_UQ),
+                         _mm256_cmp_pd(v, _mm256_set1_pd(-9999), _CMP_NEQ_UQ));
+}
+
+__attribute__((target("sse2"))) static void
+mtrlj_aggregate_sse2(const double *values, const unsigned char *valid,
+                     size_t size, struct mtrlj_aggregate *agg)
+{
+    const __m128d inf = _mm_set1_pd(HUGE_VAL);
+    const __m128d ninf = _mm_set1_pd(-HUGE_VAL);
+    __m128d vmin = inf, vmax = ninf, vsum = _mm_setzero_pd();
+    double lanes[2];
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i + 2 <= size; i += 2) {
+        __m128d v = _mm_loadu_pd(values + i);
+        __m128d mask = mtrlj_mask_sse2(v, valid, i);
+
+        vmin = _mm_min_pd(vmin, _mm_or_pd(_mm_and_pd(mask, v),
+                                          _mm_andnot_pd(mask, inf)));
+        vmax = _mm_max_pd(vmax, _mm_or_pd(_mm_and_pd(mask, v),
+                                          _mm_andnot_pd(mask, ninf)));
+        vsum = _mm_add_pd(vsum, _mm_and_pd(mask, v));
+        count += (_mm_movemask_pd(mask) & 1) + (_mm_movemask_pd(mask) >> 1);
+    }
+
+    _mm_storeu_pd(lanes, vmin);
+    agg->min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    _mm_storeu_pd(lanes, vmax);
+    agg->max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    _mm_storeu_pd(lanes, vsum);
+    agg->sum = lanes[0] + lanes[1];
+    agg->count = count;
+
+    mtrlj_aggregate_scalar(values, valid, i, size, agg);
+}
+
+__attribute__((target("avx2"))) static void
+mtrlj_aggregate_avx2(const double *values, const unsigned char *valid,
+                     size_t size, struct mtrlj_aggregate *agg)
+{
+    const __m256d inf = _mm256_set1_pd(HUGE_VAL);
+    const __m256d ninf = _mm256_set1_pd(-HUGE_VAL);
+    __m256d vmin = inf, vmax = ninf, vsum = _mm256_setzero_pd();
+    double lanes[4];
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i + 4 <= size; i += 4) {
+        __m256d v = _mm256_loadu_pd(values + i);
+        __m256d mask = mtrlj_mask_avx2(v, valid, i);
+
+        vmin = _mm256_min_pd(vmin, _mm256_blendv_pd(inf, v, mask));
+        vmax = _mm256_max_pd(vmax, _mm256_blendv_pd(ninf, v, mask));
+        vsum = _mm256_add_pd(vsum, _mm256_and_pd(mask, v));
+        count += __builtin_popcount(_mm256_movemask_pd(mask));
+    }
+
+    _mm256_storeu_pd(lanes, vmin);
+    agg->min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    agg->min = lanes[2] < agg->min ? lanes[2] : agg->min;
+    agg->min = lanes[3] < agg->min ? lanes[3] : agg->min;
+    _mm256_storeu_pd(lanes, vmax);
+    agg->max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    agg->max = lanes[2] > agg->max ? lanes[2] : agg->max;
+    agg->max = lanes[3] > agg->max ? lanes[3] : agg->max;
+    _mm256_storeu_pd(lanes, vsum);
+    agg->sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    agg->count = count;
+
+    mtrlj_aggregate_scalar(values, valid, i, size, agg);
+}
+#endif
+
+void mtrlj_column_aggregate(const double *values, const unsigned char *valid,
+                            size_t size, struct mtrlj_aggregate *aggregate)
+{
+    aggregate->count = 0;
+    aggregate->min = HUGE_VAL;
+    aggregate->max = -HUGE_VAL;
+    aggregate->sum = 0;
+
+#ifdef MTRLJ_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        mtrlj_aggregate_avx2(values, valid, size, aggregate);
+    else if (__builtin_cpu_supports("sse2"))
+        mtrlj_aggregate_sse2(values, valid, size, aggregate);
+    else
+        mtrlj_aggregate_scalar(values, valid, 0, size, aggregate);
+#else
+    mtrlj_aggregate_scalar(values, valid, 0, size, aggregate);
+#endif
+
+    if (aggregate->count == 0) {
+        aggregate->min = -9999;
+        aggregate->max = -9999;
+        aggregate->mean = -9999;
+    } else {
+        aggregate->mean = aggregate->sum / aggregate->count;
+    }
+}
+
+void mtrlj_column_aggregate_grouped(const double *values,
+                                    const unsigned char *valid, size_t size,
+                                    const int *group, size_t group_count,
+                                    struct mtrlj_aggregate *aggregates)
+{
+    size_t i;
+
+    for (i = 0; i < group_count; i++) {
+        aggregates[i].count = 0;
+        aggregates[i].min = HUGE_VAL;
+        aggregates[i].max = -HUGE_VAL;
+        aggregates[i].sum = 0;
+    }
+
+    /* scattered writes don't vectorise, plain loop is what we can do here */
+    for (i = 0; i < size; i++) {
+        struct mtrlj_aggregate *agg;
+
+        if (group[i] < 0 || (size_t)group[i] >= group_count)
+            continue;
+
+        agg = aggregates + group[i];
+        mtrlj_aggregate_scalar(values, valid, i, i + 1, agg);
+    }
+
+    for (i = 0; i < group_count; i++) {
+        if (aggregates[i].count == 0) {
+            aggregates[i].min = -9999;
+            aggregates[i].max = -9999;
+            aggregates[i].mean = -9999;
+        } else {
+            aggregates[i].mean = aggregates[i].sum / aggregates[i].count;
+        }
+    }
+}
+
+MTRLJ_CODE mtrlj_column_percentiles(const double *values,
+                                    const unsigned char *valid, size_t size,
+                                    const double *percents, size_t count,
+                                    double *results)
+{
+    double *sorted;
+    size_t n = 0;
+    size_t i;
+
+    sorted = malloc((size ? size : 1) * sizeof(double));
+    for (i = 0; i < size; i++) {
+        if (valid ? MTRLJ_COLUMN_VALID(valid, i)
+                  : mtrlj_value_available(values[i]))
+            sorted[n++] = values[i];
+    }
+
+    if (n == 0) {
+        free(sorted);
+        return MTRLJ_NOT_AVAILABLE;
+    }
+
+    qsort(sorted, n, sizeof(double), mtrlj_compare_doubles);
+
+    for (i = 0; i < count; i++) {
+        double rank = percents[i] / 100 * (n - 1);
+        size_t lower;
+
+        if (rank < 0)
+            rank = 0;
+        if (rank > n - 1)
+            rank = n - 1;
+
+        lower = (size_t)rank;
+        if (lower + 1 < n)
+            results[i] = sorted[lower]
+                         + (rank - lower) * (sorted[lower + 1] - sorted[lower]);
+        else
+            results[i] = sorted[lower];
+    }
+
+    free(sorted);
+    return MTRLJ_OK;
+}
+
+/* Wind kernels */
+
+#define MTRLJ_PI 3.14159265358979323846
+
+/* Taylor series for sin(r)/r and cos(r) in r^2, good to ~1e-9 when r is in
+   [-pi/4, pi/4]. Evaluated with Horner's method. */
+static const double mtrlj_sin_coefficients[] = {
+    1.0 / 362880, -1.0 / 5040, 1.0 / 120, -1.0 / 6, 1};
+static const double mtrlj_cos_coefficients[] = {
+    -1.0 / 3628800, 1.0 / 40320, -1.0 / 720, 1.0 / 24, -1.0 / 2, 1};
+
+/* Same approximation as the vector versions, so every path agrees. */
+static void mtrlj_sincos_degrees(double degrees, double *sine, double *cosine)
+{
+    double x = degrees * (MTRLJ_PI / 180);
+    double q = floor(x / (MTRLJ_PI / 2) + 0.5);
+    double r = x - q * (MTRLJ_PI / 2);
+    double r2 = r * r;
+    double s = mtrlj_sin_coefficients[0];
+    double c = mtrlj_cos_coefficients[0];
+    int quadrant = (int)q & 3;
+    size_t i;
+
+    for (i = 1; i < 5; i++)
+        s = s * r2 + mtrlj_sin_coefficients[i];
+    for (i = 1; i < 6; i++)
+        c = c * r2 + mtrlj_cos_coefficients[i];
+    s *= r;
+
+    switch (quadrant) {
+    case 0:
+        *sine = s;
+        *cosine = c;
+        break;
+    case 1:
+        *sine = c;
+        *cosine = -s;
+        break;
+    case 2:
+        *sine = -s;
+        *cosine = -c;
+        break;
+    default:
+        *sine = -c;
+        *cosine = s;
+        break;
+    }
+}
+
+struct mtrlj_wind_sums {
+    size_t count;
+    double u, v, speed;
+};
+
+static int mtrlj_row_available(const double *values, const unsigned char *valid,
+                               size_t i)
+{
+    return valid ? MTRLJ_COLUMN_VALID(valid, i)
+                 : mtrlj_value_available(values[i]);
+}
+
+static void mtrlj_wind_sums_scalar(const double *speed,
+                                   const unsigned char *speed_valid,
+                                   const double *direction,
+                                   const unsigned char *direction_valid,
+                                   size_t begin, size_t end,
+                                   struct mtrlj_wind_sums *sums)
+{
+    size_t i;
+
+    for (i = begin; i < end; i++) {
+        double s, c, magnitude = 1;
+
+        if (!mtrlj_row_available(direction, direction_valid, i))
+            continue;
+        if (speed) {
+            if (!mtrlj_row_available(speed, speed_valid, i))
+                continue;
+            magnitude = speed[i];
+        }
+
+        mtrlj_sincos_degrees(direction[i], &s, &c);
+        sums->u += magnitude * s;
+        sums->v += magnitude * c;
+        sums->speed += magnitude;
+        sums->count++;
+    }
+}
+
+#ifdef MTRLJ_X86_SIMD
+__attribute__((target("sse2"))) static void
+mtrlj_wind_sums_sse2(const double *speed, const unsigned char *speed_valid,
+                     const double *direction,
+                     const unsigned char *direction_valid, size_t size,
+                     struct mtrlj_wind_sums *sums)
+{
+    const __m128d to_radians = _mm_set1_pd(MTRLJ_PI / 180);
+    const __m128d to_quadrants = _mm_set1_pd(2 / MTRLJ_PI);
+    const __m128d half_pi = _mm_set1_pd(MTRLJ_PI / 2);
+    const __m128d ones = _mm_set1_pd(1);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+    const __m128d sign = _mm_set1_pd(-0.0);
+    __m128d vu = _mm_setzero_pd(), vv = _mm_setzero_pd();
+    __m128d vspeed = _mm_setzero_pd();
+    double lanes[2];
+    size_t count = 0;
+    size_t i, k;
+
+    for (i = 0; i + 2 <= size; i += 2) {
+        __m128d d = _mm_loadu_pd(direction + i);
+        __m128d mask = mtrlj_mask_sse2(d, direction_valid, i);
+        __m128d magnitude = ones;
+        __m128d x, r, r2, s, c, swap, sin_neg, cos_neg, sine, cosine;
+        __m128i q;
+
+        if (speed) {
+            magnitude = _mm_loadu_pd(speed + i);
+            mask = _mm_and_pd(mask, mtrlj_mask_sse2(magnitude, speed_valid, i));
+        }
+        magnitude = _mm_and_pd(mask, magnitude);
+
+        /* q = round(x / (pi / 2)), r = x - q * pi / 2 */
+        x = _mm_mul_pd(d, to_radians);
+        q = _mm_cvtpd_epi32(_mm_mul_pd(x, to_quadrants));
+        r = _mm_sub_pd(x, _mm_mul_pd(_mm_cvtepi32_pd(q), half_pi));
+        r2 = _mm_mul_pd(r, r);
+        s = _mm_set1_pd(mtrlj_sin_coefficients[0]);
+        for (k = 1; k < 5; k++)
+            s = _mm_add_pd(_mm_mul_pd(s, r2),
+                           _mm_set1_pd(mtrlj_sin_coefficients[k]));
+        s = _mm_mul_pd(s, r);
+        c = _mm_set1_pd(mtrlj_cos_coefficients[0]);
+        for (k = 1; k < 6; k++)
+            c = _mm_add_pd(_mm_mul_pd(c, r2),
+                           _mm_set1_pd(mtrlj_cos_coefficients[k]));
+
+        /* spread the two 32 bit quadrants to 64 bit lanes */
+        q = _mm_unpacklo_epi32(q, q);
+        swap = _mm_castsi128_pd(
+            _mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+        sin_neg = _mm_castsi128_pd(
+            _mm_cmpeq_epi32(_mm_and_si128(q, two), two));
+        cos_neg = _mm_castsi128_pd(_mm_cmpeq_epi32(
+            _mm_and_si128(_mm_add_epi32(q, one), two), two));
+
+        sine = _mm_or_pd(_mm_and_pd(swap, c), _mm_andnot_pd(swap, s));
+        cosine = _mm_or_pd(_mm_and_pd(swap, s), _mm_andnot_pd(swap, c));
+        sine = _mm_xor_pd(sine, _mm_and_pd(sin_neg, sign));
+        cosine = _mm_xor_pd(cosine, _mm_and_pd(cos_neg, sign));
+
+        vu = _mm_add_pd(vu, _mm_mul_pd(magnitude, sine));
+        vv = _mm_add_pd(vv, _mm_mul_pd(magnitude, cosine));
+        vspeed = _mm_add_pd(vspeed, magnitude);
+        count += (_mm_movemask_pd(mask) & 1) + (_mm_movemask_pd(mask) >> 1);
+    }
+
+    _mm_storeu_pd(lanes, vu);
+    sums->u = lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, vv);
+    sums->v = lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, vspeed);
+    sums->speed = lanes[0] + lanes[1];
+    sums->count = count;
+
+    mtrlj_wind_sums_scalar(speed, speed_valid, direction, direction_valid, i,
+                           size, sums);
+}
+
+__attribute__((target("avx2"))) static void
+mtrlj_wind_sums_avx2(const double *speed, const unsigned char *speed_valid,
+                     const double *direction,
+                     const unsigned char *direction_valid, size_t size,
+                     struct mtrlj_wind_sums *sums)
+{
+    const __m256d to_radians = _mm256_set1_pd(MTRLJ_PI / 180);
+    const __m256d to_quadrants = _mm256_set1_pd(2 / MTRLJ_PI);
+    const __m256d half_pi = _mm256_set1_pd(MTRLJ_PI / 2);
+    const __m256d ones = _mm256_set1_pd(1);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i two = _mm256_set1_epi64x(2);
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d vu = _mm256_setzero_pd(), vv = _mm256_setzero_pd();
+    __m256d vspeed = _mm256_setzero_pd();
+    double lanes[4];
+    size_t count = 0;
+    size_t i, k;
+
+    for (i = 0; i + 4 <= size; i += 4) {
+        __m256d d = _mm256_loadu_pd(direction + i);
+        __m256d mask = mtrlj_mask_avx2(d, direction_valid, i);
+        __m256d magnitude = ones;
+        __m256d x, qd, r, r2, s, c, swap, sin_neg, cos_neg, sine, cosine;
+        __m256i q;
+
+        if (speed) {
+            magnitude = _mm256_loadu_pd(speed + i);
+            mask =
+                _mm256_and_pd(mask, mtrlj_mask_avx2(magnitude, speed_valid, i));
+        }
+        magnitude = _mm256_and_pd(mask, magnitude);
+
+        x = _mm256_mul_pd(d, to_radians);
+        qd = _mm256_round_pd(_mm256_mul_pd(x, to_quadrants),
+                             _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        r = _mm256_sub_pd(x, _mm256_mul_pd(qd, half_pi));
+        r2 = _mm256_mul_pd(r, r);
+        s = _mm256_set1_pd(mtrlj_sin_coefficients[0]);
+        for (k = 1; k < 5; k++)
+            s = _mm256_add_pd(_mm256_mul_pd(s, r2),
+                              _mm256_set1_pd(mtrlj_sin_coefficients[k]));
+        s = _mm256_mul_pd(s, r);
+        c = _mm256_set1_pd(mtrlj_cos_coefficients[0]);
+        for (k = 1; k < 6; k++)
+            c = _mm256_add_pd(_mm256_mul_pd(c, r2),
+                              _mm256_set1_pd(mtrlj_cos_coefficients[k]));
+
+        q = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(qd));
+        swap = _mm256_castsi256_pd(
+            _mm256_cmpeq_epi64(_mm256_and_si256(q, one), one));
+        sin_neg = _mm256_castsi256_pd(
+            _mm256_cmpeq_epi64(_mm256_and_si256(q, two), two));
+        cos_neg = _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+            _mm256_and_si256(_mm256_add_epi64(q, one), two), two));
+
+        sine = _mm256_blendv_pd(s, c, swap);
+        cosine = _mm256_blendv_pd(c, s, swap);
+        sine = _mm256_xor_pd(sine, _mm256_and_pd(sin_neg, sign));
+        cosine = _mm256_xor_pd(cosine, _mm256_and_pd(cos_neg, sign));
+
+        vu = _mm256_add_pd(vu, _mm256_mul_pd(magnitude, sine));
+        vv = _mm256_add_pd(vv, _mm256_mul_pd(magnitude, cosine));
+        vspeed = _mm256_add_pd(vspeed, magnitude);
+        count += __builtin_popcount(_mm256_movemask_pd(mask));
+    }
+
+    _mm256_storeu_pd(lanes, vu);
+    sums->u = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, vv);
+    sums->v = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, vspeed);
+    sums->speed = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    sums->count = count;
+
+    mtrlj_wind_sums_scalar(speed, speed_valid, direction, direction_valid, i,
+                           size, sums);
+}
+#endif
+
+void mtrlj_wind_vector_mean(const double *speed,
+                            const unsigned char *speed_valid,
+                            const double *direction,
+                            const unsigned char *direction_valid, size_t size,
+                            struct mtrlj_wind_mean *mean)
+{
+    struct mtrlj_wind_sums sums = {0};
+    double length;
+
+#ifdef MTRLJ_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        mtrlj_wind_sums_avx2(speed, speed_valid, direction, direction_valid,
+                             size, &sums);
+    else if (__builtin_cpu_supports("sse2"))
+        mtrlj_wind_sums_sse2(speed, speed_valid, direction, direction_valid,
+                             size, &sums);
+    else
+        mtrlj_wind_sums_scalar(speed, speed_valid, direction,
+                               direction_valid, 0, size, &sums);
+#else
+    mtrlj_wind_sums_scalar(speed, speed_valid, direction, direction_valid, 0,
+                           size, &sums);
+#endif
+
+    mean->count = sums.count;
+    if (sums.count == 0) {
+        mean->speed = -9999;
+        mean->direction = -9999;
+        mean->steadiness = -9999;
+        return;
+    }
+
+    length = sqrt(sums.u * sums.u + sums.v * sums.v);
+    mean->speed = length / sums.count;
+    mean->steadiness = sums.speed > 0 ? length / sums.speed : 0;
+    mean->direction = atan2(sums.u, sums.v) * (180 / MTRLJ_PI);
+    if (mean->direction < 0)
+        mean->direction += 360;
+}
+
+double mtrlj_wind_max_gust(const double *speed, const unsigned char *valid,
+                           size_t size)
+{
+    struct mtrlj_aggregate aggregate;
+
+    mtrlj_column_aggregate(speed, valid, size, &aggregate);
+    return aggregate.max;
+}
+
+/* Change detection */
+
+struct mtrlj_tracked_situation {
+    int district_id; /* 0 if the slot is empty */
+    unsigned long hash;
+    struct mtrlj_time time;
+    MTRLJ_WEATHER_CONDITION condition;
+    double fields[MTRLJ_SITUATION_FIELD_COUNT];
+};
+
+void mtrlj_change_tracker_init(struct mtrlj_change_tracker *tracker)
+{
+    memset(tracker, 0, sizeof(*tracker));
+}
+
+static unsigned long mtrlj_situation_hash(MTRLJ_WEATHER_CONDITION condition,
+                                          const double *fields)
+{
+    unsigned long hash = 2166136261UL;
+    const unsigned char *p = (const unsigned char *)fields;
+    size_t i;
+
+    for (i = 0; i < MTRLJ_SITUATION_FIELD_COUNT * sizeof(double); i++)
+        hash = ((hash ^ p[i]) * 16777619UL) & 0xffffffffUL;
+
+    return ((hash ^ (unsigned long)condition) * 16777619UL) & 0xffffffffUL;
+}
+
+static struct mtrlj_tracked_situation *
+mtrlj_tracked_slot(struct mtrlj_tracked_situation *slots, size_t capacity,
+                   int district_id)
+{
+    size_t i = ((unsigned long)district_id * 2654435761UL) & (capacity - 1);
+
+    while (slots[i].district_id != 0 && slots[i].district_id != district_id)
+        i = (i + 1) & (capacity - 1);
+
+    return &slots[i];
+}
+
+static unsigned long mtrlj_track(struct mtrlj_change_tracker *tracker,
+                                 int district_id,
+                                 MTRLJ_WEATHER_CONDITION condition,
+                                 const struct mtrlj_time *time,
+                                 const double *fields)
+{
+    struct mtrlj_tracked_situation *tracked;
+    unsigned long hash = mtrlj_situation_hash(condition, fields);
+    unsigned long changed = 0;
+    size_t i;
+
+    if (district_id == 0) /* it marks empty slots */
+        return 0;
+
+    if ((tracker->size + 1) * 2 > tracker->capacity) {
+        struct mtrlj_tracked_situation *old = tracker->slots;
+        size_t old_capacity = tracker->capacity;
+
+        tracker->capacity = old_capacity ? old_capacity * 2 : 256;
+        tracker->slots = calloc(tracker->capacity,
+                                sizeof(struct mtrlj_tracked_situation));
+        for (i = 0; i < old_capacity; i++) {
+            if (old[i].district_id != 0)
+                *mtrlj_tracked_slot(tracker->slots, tracker->capacity,
+                                    old[i].district_id) = old[i];
+        }
+        free(old);
+    }
+
+    tracked =
+        mtrlj_tracked_slot(tracker->slots, tracker->capacity, district_id);
+
+    if (tracked->district_id == 0) {
+        tracked->district_id = district_id;
+        tracker->size++;
+        changed = MTRLJ_CHANGED_NEW;
+    } else if (tracked->hash == hash
+               && memcmp(&tracked->time, time, sizeof(struct mtrlj_time)) == 0
+               && tracked->condition == condition
+               && memcmp(tracked->fields, fields, sizeof(tracked->fields))
+                      == 0) {
+        /* the usual case, nothing new. The hash only rules it out early,
+           colliding ones are caught by the comparisons */
+        return 0;
+    } else {
+        if (memcmp(&tracked->time, time, sizeof(struct mtrlj_time)) != 0)
+            changed |= MTRLJ_CHANGED_TIME;
+        if (tracked->condition != condition)
+            changed |= MTRLJ_CHANGED_CONDITION;
+        for (i = 0; i < MTRLJ_SITUATION_FIELD_COUNT; i++) {
+            if (tracked->fields[i] != fields[i])
+                changed |= MTRLJ_FIELD_BIT(i);
+        }
+    }
+
+    tracked->hash = hash;
+    tracked->time = *time;
+    tracked->condition = condition;
+    memcpy(tracked->fields, fields, sizeof(tracked->fields));
+
+    return changed;
+}
+
+unsigned long mtrlj_track_situation(struct mtrlj_change_tracker *tracker,
+                                    int district_id,
+                                    const struct mtrlj_situation *situation)
+{
+    double fields[MTRLJ_SITUATION_FIELD_COUNT];
+
+    mtrlj_situation_fields(situation, fields);
+    return mtrlj_track(tracker, district_id, situation->condition,
+                       &situation->time, fields);
+}
+
+size_t
+mtrlj_track_situation_columns(struct mtrlj_change_tracker *tracker,
+                              const struct mtrlj_situation_columns *columns,
+                              struct mtrlj_change *changes)
+{
+    double fields[MTRLJ_SITUATION_FIELD_COUNT];
+    size_t count = 0;
+    size_t row, i;
+
+    for (row = 0; row < columns->size; row++) {
+        unsigned long changed;
+
+        for (i = 0; i < MTRLJ_SITUATION_FIELD_COUNT; i++)
+            fields[i] = columns->values[i][row];
+
+        changed = mtrlj_track(tracker, columns->district_id[row],
+                              columns->condition[row], &columns->time[row],
+                              fields);
+        if (changed) {
+            changes[count].district_id = columns->district_id[row];
+            changes[count].fields = changed;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/* Polling scheduler */
+
+#define MTRLJ_POLL_MARGIN 30
+#define MTRLJ_POLL_MIN_INTERVAL 60
+
+/* Unix time of a Türkiye time, fields don't have to be normalized. */
+static long mtrlj_time_seconds(const struct mtrlj_time *time)
+{
+    long year = time->year - (time->month <= 2);
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long year_of_era = year - era * 400;
+    long day_of_year =
+        (153 * (time->month + (time->month > 2 ? -3 : 9)) + 2) / 5 + time->day
+        - 1;
+    long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100
+                      + day_of_year;
+    long days = era * 146097 + day_of_era - 719468;
+
+    return days * 86400 + (time->hour - 3) * 3600L + time->minute * 60L
+           + time->second;
+}
+
+void mtrlj_poll_schedule_init(struct mtrlj_poll_schedule *schedule,
+                              const struct mtrlj_district *districts,
+                              size_t size, long default_interval)
+{
+    schedule->districts = districts;
+    schedule->size = size;
+    schedule->default_interval = default_interval;
+    schedule->next_due = calloc(size ? size : 1, sizeof(long));
+    schedule->cadence = calloc(size ? size : 1, sizeof(long));
+    schedule->lag = calloc(size ? size : 1, sizeof(long));
+    schedule->last_data = calloc(size ? size : 1, sizeof(long));
+}
+
+/* Learns from a veriZamani seen at `now` and returns when to poll next. */
+static long mtrlj_poll_learn(long *cadence, long *lag, long *last_data,
+                             long default_interval,
+                             const struct mtrlj_time *time, long now)
+{
+    long data = mtrlj_time_seconds(time);
+    long seen_lag = now > data ? now - data : 0;
+    long next;
+
+    if (*last_data == 0) {
+        *last_data = data;
+        *lag = seen_lag;
+        next = now + default_interval;
+    } else if (data > *last_data) {
+        long interval = data - *last_data;
+
+        *cadence = *cadence ? (3 * *cadence + interval) / 4 : interval;
+
+        /* we see it late if we polled late, so believe the smaller ones */
+        *lag = seen_lag < *lag ? seen_lag : (3 * *lag + seen_lag) / 4;
+
+        *last_data = data;
+        next = data + *cadence + *lag + MTRLJ_POLL_MARGIN;
+    } else {
+        /* expected one is late, look again a bit later */
+        next = now + (*cadence ? *cadence / 4 : default_interval);
+    }
+
+    if (next < now + MTRLJ_POLL_MIN_INTERVAL)
+        next = now + MTRLJ_POLL_MIN_INTERVAL;
+    return next;
+}
+
+void mtrlj_poll_observe(struct mtrlj_poll_schedule *schedule, size_t index,
+                        const struct mtrlj_time *time, long now)
+{
+    schedule->next_due[index] = mtrlj_poll_learn(
+        &schedule->cadence[index], &schedule->lag[index],
+        &schedule->last_data[index], schedule->default_interval, time, now);
+}
 
-    url_parameters[0] = calloc(128, sizeof(char));
-    url_parameters[1] = calloc(128, sizeof(char));
-    sprintf(url_parameters[0], "il=%s", city_name);
-    sprintf(url_parameters[1], "ilce=%s", district_name);
+size_t mtrlj_poll_due(struct mtrlj_poll_schedule *schedule, long now,
+                      struct mtrlj_situation_columns *columns)
+{
+    size_t count = 0;
+    size_t i;
 
-    if (!mtrlj_curl_get_params(DISTRICT_ENDPOINT, (const char **)url_parameters,
-                               2, &mcp)) {
-        return_code = MTRLJ_REQUEST_FAILED;
-        goto end;
+    for (i = 0; i < schedule->size; i++) {
+        struct mtrlj_situation situation;
+
+        if (schedule->next_due[i] > now)
+            continue;
+
+        count++;
+        if (mtrlj_latest_situation(schedule->districts[i], &situation)
+            != MTRLJ_OK) {
+            schedule->next_due[i] = now + schedule->default_interval;
+            continue;
+        }
+
+        if (columns)
+            mtrlj_situation_columns_append(
+                columns, schedule->districts[i].id, &situation);
+        mtrlj_poll_observe(schedule, i, &situation.time, now);
     }
 
-    district_json = cJSON_Parse(mcp.response);
-    if (district_json == NULL || !cJSON_IsArray(district_json)
-        || cJSON_GetArraySize(district_json) != 1) {
-        return_code = MTRLJ_JSON_PARSING_FAILED;
-        goto end;
+    return count;
+}
+
+long mtrlj_poll_next_wakeup(const struct mtrlj_poll_schedule *schedule)
+{
+    long wakeup = 0;
+    size_t i;
+
+    for (i = 0; i < schedule->size; i++) {
+        if (i == 0 || schedule->next_due[i] < wakeup)
+            wakeup = schedule->next_due[i];
     }
 
-    return_code = mtrlj_json_parse_district(
-        cJSON_GetArrayItem(district_json, 0), district);
+    return wakeup;
+}
+
+/* Subscriptions. Every (product, district) pair subscribed is a feed with a
+   list of subscribers. Only the engine thread frees feeds, others just add
+   feeds and subscribers, so it can keep using a feed while it is fetching
+   without holding the lock. */
+
+struct mtrlj_subscriber {
+    struct mtrlj_subscriber *next;
+    int id;
+    int pending; /* hasn't been told about the current data yet */
+    mtrlj_update_callback callback;
+    void *ctx;
+};
+
+struct mtrlj_feed {
+    struct mtrlj_feed *next;
+    struct mtrlj_subscriber *subscribers;
+    struct mtrlj_district district;
+    MTRLJ_SUBSCRIBE_PRODUCT product;
+
+    int has_data;
+    unsigned long hash;
+    union mtrlj_payload payload;
+    size_t hourly_size;
+
+    long next_due;
+    long cadence, lag, last_data;
+};
+
+static struct {
+    struct mtrlj_feed *feeds;
+    int last_id;
+    long interval;
+    int started, stopping;
+} mtrlj_engine = {NULL, 0, 600, 0, 0};
+
+static pthread_mutex_t mtrlj_engine_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mtrlj_engine_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t mtrlj_engine_thread;
+
+static unsigned long mtrlj_bytes_hash(const void *bytes, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)bytes;
+    unsigned long hash = 2166136261UL;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        hash = ((hash ^ p[i]) * 16777619UL) & 0xffffffffUL;
+
+    return hash;
+}
+
+/* Fetches a feed into `payload`, returns its content hash. `age` fields are
+   left out of it since they change without the data changing. */
+static MTRLJ_CODE mtrlj_feed_fetch(const struct mtrlj_feed *feed,
+                                   union mtrlj_payload *payload,
+                                   size_t *hourly_size, unsigned long *hash)
+{
+    MTRLJ_CODE return_code = MTRLJ_NOT_AVAILABLE;
+    long age = 0;
+    size_t i;
+
+    memset(payload, 0, sizeof(*payload)); /* padding is hashed too */
+    *hourly_size = 0;
+
+    switch (feed->product) {
+    case MTRLJ_SUBSCRIBE_SITUATION:
+        return_code =
+            mtrlj_latest_situation(feed->district, &payload->situation);
+        age = payload->situation.age;
+        payload->situation.age = 0;
+        *hash = mtrlj_bytes_hash(&payload->situation,
+                                 sizeof(struct mtrlj_situation));
+        payload->situation.age = age;
+        break;
+    case MTRLJ_SUBSCRIBE_FIVE_DAYS:
+        return_code =
+            mtrlj_five_days_forecast_buf(feed->district, payload->daily);
+        *hash = mtrlj_bytes_hash(payload->daily,
+                                 5 * sizeof(struct mtrlj_daily_forecast));
+        break;
+    case MTRLJ_SUBSCRIBE_HOURLY:
+        return_code = mtrlj_hourly_forecasts_buf(
+            feed->district, payload->hourly, MTRLJ_HOURLY_FORECAST_MAX,
+            hourly_size);
+        if (return_code != MTRLJ_OK)
+            break;
+        age = *hourly_size ? payload->hourly[0].age : 0;
+        for (i = 0; i < *hourly_size; i++)
+            payload->hourly[i].age = 0;
+        *hash = mtrlj_bytes_hash(payload->hourly,
+                                 *hourly_size
+                                     * sizeof(struct mtrlj_hourly_forecast));
+        for (i = 0; i < *hourly_size; i++)
+            payload->hourly[i].age = age;
+        break;
+    }
+
+    return return_code;
+}
+
+/* Called with the lock held, returns with it held. */
+static void mtrlj_feed_notify(struct mtrlj_feed *feed, int changed)
+{
+    struct mtrlj_update update;
+    union mtrlj_payload payload;
+    struct mtrlj_subscriber *subscriber, *targets = NULL;
+
+    /* copy what is needed, callbacks run without the lock */
+    for (subscriber = feed->subscribers; subscriber;
+         subscriber = subscriber->next) {
+        struct mtrlj_subscriber *target;
+
+        if (!changed && !subscriber->pending)
+            continue;
+
+        subscriber->pending = 0;
+        target = malloc(sizeof(struct mtrlj_subscriber));
+        *target = *subscriber;
+        target->next = targets;
+        targets = target;
+    }
+
+    if (targets == NULL)
+        return;
+
+    memset(&update, 0, sizeof(update));
+    memcpy(&payload, &feed->payload, sizeof(payload));
+    update.district = feed->district;
+    update.product = feed->product;
+    if (feed->product == MTRLJ_SUBSCRIBE_SITUATION)
+        update.situation = &payload.situation;
+    else if (feed->product == MTRLJ_SUBSCRIBE_FIVE_DAYS)
+        update.five_days = payload.daily;
+    else {
+        update.hourly = payload.hourly;
+        update.hourly_size = feed->hourly_size;
+    }
+
+    pthread_mutex_unlock(&mtrlj_engine_lock);
+    while (targets) {
+        subscriber = targets;
+        targets = targets->next;
+        subscriber->callback(&update, subscriber->ctx);
+        free(subscriber);
+    }
+    pthread_mutex_lock(&mtrlj_engine_lock);
+}
+
+static void mtrlj_feed_poll(struct mtrlj_feed *feed, long now)
+{
+    union mtrlj_payload payload;
+    size_t hourly_size;
+    unsigned long hash = 0;
+    MTRLJ_CODE return_code;
+    int changed;
+
+    pthread_mutex_unlock(&mtrlj_engine_lock);
+    return_code = mtrlj_feed_fetch(feed, &payload, &hourly_size, &hash);
+    pthread_mutex_lock(&mtrlj_engine_lock);
+
+    if (return_code != MTRLJ_OK) {
+        feed->next_due = now + mtrlj_engine.interval;
+        return;
+    }
+
+    changed = !feed->has_data || feed->hash != hash;
+    feed->has_data = 1;
+    feed->hash = hash;
+    feed->payload = payload;
+    feed->hourly_size = hourly_size;
+
+    if (feed->product == MTRLJ_SUBSCRIBE_SITUATION)
+        feed->next_due =
+            mtrlj_poll_learn(&feed->cadence, &feed->lag, &feed->last_data,
+                             mtrlj_engine.interval, &payload.situation.time,
+                             now);
+    else
+        feed->next_due = now + mtrlj_engine.interval;
+
+    mtrlj_feed_notify(feed, changed);
+}
+
+static void *mtrlj_engine_main(void *unused)
+{
+    (void)unused;
+
+    mtrlj_set_priority(MTRLJ_PRIORITY_BACKGROUND);
+
+    pthread_mutex_lock(&mtrlj_engine_lock);
+    while (!mtrlj_engine.stopping) {
+        struct mtrlj_feed **link = &mtrlj_engine.feeds;
+        struct mtrlj_feed *feed;
+        long now = (long)time(NULL);
+        long wakeup = now + 3600;
+        struct timespec until;
+
+        while ((feed = *link) != NULL && !mtrlj_engine.stopping) {
+            if (feed->subscribers == NULL) {
+                *link = feed->next;
+                free(feed);
+                continue;
+            }
+
+            if (feed->next_due <= now)
+                mtrlj_feed_poll(feed, now);
+            else if (feed->has_data)
+                mtrlj_feed_notify(feed, 0); /* for new subscribers */
+
+            if (feed->next_due < wakeup)
+                wakeup = feed->next_due;
+            link = &feed->next;
+        }
+
+        if (mtrlj_engine.stopping || wakeup <= (long)time(NULL))
+            continue;
+
+        until.tv_sec = wakeup;
+        until.tv_nsec = 0;
+        pthread_cond_timedwait(&mtrlj_engine_wake, &mtrlj_engine_lock,
+                               &until);
+    }
+    pthread_mutex_unlock(&mtrlj_engine_lock);
+
+    return NULL;
+}
+
+int mtrlj_subscribe(struct mtrlj_district district, int products,
+                    mtrlj_update_callback callback, void *ctx)
+{
+    static const MTRLJ_SUBSCRIBE_PRODUCT all[] = {MTRLJ_SUBSCRIBE_SITUATION,
+                                                  MTRLJ_SUBSCRIBE_FIVE_DAYS,
+                                                  MTRLJ_SUBSCRIBE_HOURLY};
+    int id = -1;
+    size_t i;
+
+    pthread_mutex_lock(&mtrlj_engine_lock);
+
+    if (!mtrlj_engine.started) {
+        mtrlj_curl_global_once();
+        if (pthread_create(&mtrlj_engine_thread, NULL, mtrlj_engine_main,
+                           NULL)
+            != 0)
+            goto end;
+        mtrlj_engine.started = 1;
+    }
+
+    id = ++mtrlj_engine.last_id;
+    for (i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        struct mtrlj_feed *feed;
+        struct mtrlj_subscriber *subscriber;
+
+        if (!(products & all[i]))
+            continue;
+
+        for (feed = mtrlj_engine.feeds; feed; feed = feed->next) {
+            if (feed->product == all[i] && feed->district.id == district.id)
+                break;
+        }
+
+        if (feed == NULL) {
+            feed = calloc(1, sizeof(struct mtrlj_feed));
+            feed->district = district;
+            feed->product = all[i];
+            feed->next = mtrlj_engine.feeds;
+            mtrlj_engine.feeds = feed;
+        }
+
+        subscriber = malloc(sizeof(struct mtrlj_subscriber));
+        subscriber->id = id;
+        subscriber->pending = 1;
+        subscriber->callback = callback;
+        subscriber->ctx = ctx;
+        subscriber->next = feed->subscribers;
+        feed->subscribers = subscriber;
+    }
+
+    pthread_cond_signal(&mtrlj_engine_wake);
 
 end:
-    free(url_parameters[0]);
-    free(url_parameters[1]);
-    cJSON_Delete(district_json);
-    free(mcp.response);
+    pthread_mutex_unlock(&mtrlj_engine_lock);
+    return id;
+}
+
+MTRLJ_CODE mtrlj_unsubscribe(int id)
+{
+    MTRLJ_CODE return_code = MTRLJ_NOT_AVAILABLE;
+    struct mtrlj_feed *feed;
+
+    pthread_mutex_lock(&mtrlj_engine_lock);
+
+    for (feed = mtrlj_engine.feeds; feed; feed = feed->next) {
+        struct mtrlj_subscriber **link = &feed->subscribers;
+
+        while (*link) {
+            struct mtrlj_subscriber *subscriber = *link;
+
+            if (subscriber->id == id) {
+                *link = subscriber->next;
+                free(subscriber);
+                return_code = MTRLJ_OK;
+            } else {
+                link = &subscriber->next;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&mtrlj_engine_lock);
     return return_code;
 }
 
-MTRLJ_CODE mtrlj_get_districts_in_city(struct mtrlj_district **districts,
-                                       size_t *size, const char *city_name)
+MTRLJ_CODE mtrlj_set_poll_interval(long seconds)
+{
+    pthread_mutex_lock(&mtrlj_engine_lock);
+    mtrlj_engine.interval = seconds;
+    pthread_mutex_unlock(&mtrlj_engine_lock);
+    return MTRLJ_OK;
+}
+
+static void mtrlj_engine_stop(void)
+{
+    struct mtrlj_feed *feed;
+
+    pthread_mutex_lock(&mtrlj_engine_lock);
+    mtrlj_engine.stopping = 1;
+    pthread_cond_signal(&mtrlj_engine_wake);
+    pthread_mutex_unlock(&mtrlj_engine_lock);
+
+    if (mtrlj_engine.started)
+        pthread_join(mtrlj_engine_thread, NULL);
+
+    while ((feed = mtrlj_engine.feeds) != NULL) {
+        struct mtrlj_subscriber *subscriber;
+
+        while ((subscriber = feed->subscribers) != NULL) {
+            feed->subscribers = subscriber->next;
+            free(subscriber);
+        }
+        mtrlj_engine.feeds = feed->next;
+        free(feed);
+    }
+
+    mtrlj_engine.started = 0;
+    mtrlj_engine.stopping = 0;
+}
+
+/* Name folding and lookup */
+
+size_t mtrlj_fold_name(const char *name, char *folded, size_t capacity)
+{
+    const unsigned char *p = (const unsigned char *)name;
+    size_t length = 0;
+    int pending_space = 0;
+
+    if (capacity == 0)
+        return 0;
+
+    while (*p) {
+        char c = 0;
+
+        if (p[0] == 0xC3 && p[1]) {
+            switch (p[1]) {
+            case 0x82: /* Â */
+            case 0xA2: /* â */
+                c = 'a';
+                break;
+            case 0x87: /* Ç */
+            case 0xA7: /* ç */
+                c = 'c';
+                break;
+            case 0x8E: /* Î */
+            case 0xAE: /* î */
+                c = 'i';
+                break;
+            case 0x96: /* Ö */
+            case 0xB6: /* ö */
+                c = 'o';
+                break;
+            case 0x9B: /* Û */
+            case 0xBB: /* û */
+            case 0x9C: /* Ü */
+            case 0xBC: /* ü */
+                c = 'u';
+                break;
+            }
+        } else if (p[0] == 0xC4 && p[1]) {
+            switch (p[1]) {
+            case 0x9E: /* Ğ */
+            case 0x9F: /* ğ */
+                c = 'g';
+                break;
+            case 0xB0: /* İ */
+            case 0xB1: /* ı */
+                c = 'i';
+                break;
+            }
+        } else if (p[0] == 0xC5 && p[1]) {
+            if (p[1] == 0x9E || p[1] == 0x9F) /* Ş ş */
+                c = 's';
+        } else if ((p[0] == 0xCC || (p[0] == 0xCD && p[1] < 0xB0)) && p[1]) {
+            /* combining marks, e.g. the dot of `i̇` from a non Turkish
+               lowercase of `İ` */
+            p += 2;
+            continue;
+        }
+
+        if (c) {
+            p += 2;
+        } else if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+            pending_space = length > 0;
+            p++;
+            continue;
+        } else if (*p >= 'A' && *p <= 'Z') {
+            c = *p++ - 'A' + 'a';
+        } else {
+            c = (char)*p++;
+        }
+
+        if (pending_space && length + 1 < capacity)
+            folded[length++] = ' ';
+        pending_space = 0;
+        if (length + 1 < capacity)
+            folded[length++] = c;
+    }
+
+    folded[length] = 0;
+    return length;
+}
+
+/* FNV-1a over folded city and district names */
+static unsigned long mtrlj_name_hash(const char *city, const char *district)
+{
+    unsigned long hash = 2166136261UL;
+
+    while (*city)
+        hash = ((hash ^ (unsigned char)*city++) * 16777619UL) & 0xffffffffUL;
+    hash = ((hash ^ 0x1f) * 16777619UL) & 0xffffffffUL;
+    while (*district)
+        hash = ((hash ^ (unsigned char)*district++) * 16777619UL)
+               & 0xffffffffUL;
+
+    return hash;
+}
+
+/* Entries are districts first and then cities, a city is keyed with empty
+   district name. */
+static const struct mtrlj_district *
+mtrlj_catalog_entry(const struct mtrlj_catalog *catalog, size_t entry)
+{
+    if (entry < catalog->size)
+        return catalog->districts + entry;
+    return catalog->cities + (entry - catalog->size);
+}
+
+static void mtrlj_catalog_entry_key(const struct mtrlj_catalog *catalog,
+                                    size_t entry, char *city, char *district,
+                                    size_t capacity)
+{
+    const struct mtrlj_district *d = mtrlj_catalog_entry(catalog, entry);
+
+    mtrlj_fold_name(d->city_name ? d->city_name : "", city, capacity);
+    if (entry < catalog->size && d->name)
+        mtrlj_fold_name(d->name, district, capacity);
+    else
+        district[0] = 0;
+}
+
+static void mtrlj_catalog_build_names(struct mtrlj_catalog *catalog)
+{
+    size_t entries = catalog->size + catalog->city_count;
+    size_t entry;
+
+    catalog->name_capacity = 16;
+    while (catalog->name_capacity < entries * 2)
+        catalog->name_capacity *= 2;
+    catalog->name_slots = calloc(catalog->name_capacity, sizeof(size_t));
+
+    for (entry = 0; entry < entries; entry++) {
+        char city[256], district[256];
+        size_t slot;
+
+        mtrlj_catalog_entry_key(catalog, entry, city, district, 256);
+        slot = mtrlj_name_hash(city, district) & (catalog->name_capacity - 1);
+
+        while (catalog->name_slots[slot] != 0) {
+            char other_city[256], other_district[256];
+
+            mtrlj_catalog_entry_key(catalog, catalog->name_slots[slot] - 1,
+                                    other_city, other_district, 256);
+            if (strcmp(city, other_city) == 0
+                && strcmp(district, other_district) == 0)
+                break; /* first one wins */
+
+            slot = (slot + 1) & (catalog->name_capacity - 1);
+        }
+
+        if (catalog->name_slots[slot] == 0)
+            catalog->name_slots[slot] = entry + 1;
+    }
+}
+
+const struct mtrlj_district *
+mtrlj_catalog_find(const struct mtrlj_catalog *catalog, const char *city_name,
+                   const char *district_name)
+{
+    char city[256], district[256];
+    size_t slot;
+
+    if (catalog->name_capacity == 0)
+        return NULL;
+
+    mtrlj_fold_name(city_name, city, 256);
+    mtrlj_fold_name(district_name ? district_name : "", district, 256);
+    slot = mtrlj_name_hash(city, district) & (catalog->name_capacity - 1);
+
+    while (catalog->name_slots[slot] != 0) {
+        char other_city[256], other_district[256];
+        size_t entry = catalog->name_slots[slot] - 1;
+
+        mtrlj_catalog_entry_key(catalog, entry, other_city, other_district,
+                                256);
+        if (strcmp(city, other_city) == 0
+            && strcmp(district, other_district) == 0)
+            return mtrlj_catalog_entry(catalog, entry);
+
+        slot = (slot + 1) & (catalog->name_capacity - 1);
+    }
+
+    return NULL;
+}
+
+/* Name search */
+
+struct mtrlj_search_item {
+    const char *name;
+    size_t entry;
+};
+
+static int mtrlj_compare_search_items(const void *a, const void *b)
+{
+    const struct mtrlj_search_item *x = (const struct mtrlj_search_item *)a;
+    const struct mtrlj_search_item *y = (const struct mtrlj_search_item *)b;
+    int res = strcmp(x->name, y->name);
+
+    if (res != 0)
+        return res;
+    return (x->entry > y->entry) - (x->entry < y->entry);
+}
+
+static const char *mtrlj_search_name(const struct mtrlj_catalog *catalog,
+                                     size_t entry)
+{
+    return catalog->search_names + catalog->search_offsets[entry];
+}
+
+static void mtrlj_catalog_build_search(struct mtrlj_catalog *catalog)
+{
+    size_t entries = catalog->size + catalog->city_count;
+    struct mtrlj_search_item *items;
+    size_t used = 0, capacity = 256;
+    size_t entry;
+
+    catalog->search_names = malloc(capacity);
+    catalog->search_offsets = calloc(entries + 1, sizeof(size_t));
+    catalog->search_order = calloc(entries + 1, sizeof(size_t));
+
+    for (entry = 0; entry < entries; entry++) {
+        const struct mtrlj_district *d = mtrlj_catalog_entry(catalog, entry);
+        const char *name = entry < catalog->size ? d->name : d->city_name;
+        char folded[256];
+        size_t length = mtrlj_fold_name(name ? name : "", folded, 256);
+
+        while (used + length + 1 > capacity) {
+            capacity *= 2;
+            catalog->search_names = realloc(catalog->search_names, capacity);
+        }
+
+        catalog->search_offsets[entry] = used;
+        memcpy(catalog->search_names + used, folded, length + 1);
+        used += length + 1;
+    }
+
+    /* names can move while growing, so they are sorted at the end */
+    items = malloc((entries + 1) * sizeof(struct mtrlj_search_item));
+    for (entry = 0; entry < entries; entry++) {
+        items[entry].name = mtrlj_search_name(catalog, entry);
+        items[entry].entry = entry;
+    }
+    qsort(items, entries, sizeof(struct mtrlj_search_item),
+          mtrlj_compare_search_items);
+    for (entry = 0; entry < entries; entry++)
+        catalog->search_order[entry] = items[entry].entry;
+
+    free(items);
+}
+
+/* Keeps `matches` sorted by score, lower is better. */
+static void mtrlj_search_insert(const struct mtrlj_district **matches,
+                                size_t *scores, size_t *found, size_t k,
+                                const struct mtrlj_district *match,
+                                size_t score)
+{
+    size_t j;
+
+    if (*found == k && score >= scores[k - 1])
+        return;
+
+    j = *found < k ? (*found)++ : k - 1;
+    while (j > 0 && scores[j - 1] > score) {
+        scores[j] = scores[j - 1];
+        matches[j] = matches[j - 1];
+        j--;
+    }
+    scores[j] = score;
+    matches[j] = match;
+}
+
+size_t mtrlj_catalog_complete(const struct mtrlj_catalog *catalog,
+                              const char *prefix,
+                              const struct mtrlj_district **matches, size_t k)
+{
+    size_t entries = catalog->size + catalog->city_count;
+    char folded[256];
+    size_t length, low = 0, high = entries, found = 0;
+    size_t *scores;
+
+    if (k == 0 || catalog->search_order == NULL)
+        return 0;
+
+    length = mtrlj_fold_name(prefix, folded, 256);
+
+    /* first name not less than prefix, all matches follow it */
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        const char *name =
+            mtrlj_search_name(catalog, catalog->search_order[middle]);
+
+        if (strcmp(name, folded) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    scores = malloc(k * sizeof(size_t));
+    for (; low < entries; low++) {
+        size_t entry = catalog->search_order[low];
+        const char *name = mtrlj_search_name(catalog, entry);
+
+        if (strncmp(name, folded, length) != 0)
+            break;
+
+        mtrlj_search_insert(matches, scores, &found, k,
+                            mtrlj_catalog_entry(catalog, entry),
+                            strlen(name));
+    }
+
+    free(scores);
+    return found;
+}
+
+/* Edit distance between `query` and the closest prefix of `name`, gives up
+   with max + 1 when it can't be at most `max`. `row` needs room for
+   strlen(name) + 1 elements. */
+static size_t mtrlj_prefix_distance(const char *query, size_t query_length,
+                                    const char *name, size_t name_length,
+                                    size_t max, size_t *row)
+{
+    size_t i, j, best;
+
+    for (j = 0; j <= name_length; j++)
+        row[j] = j;
+
+    for (i = 1; i <= query_length; i++) {
+        size_t diagonal = row[0];
+        size_t row_min;
+
+        row[0] = i;
+        row_min = row[0];
+        for (j = 1; j <= name_length; j++) {
+            size_t above = row[j];
+            size_t cost = diagonal + (query[i - 1] != name[j - 1]);
+
+            if (above + 1 < cost)
+                cost = above + 1;
+            if (row[j - 1] + 1 < cost)
+                cost = row[j - 1] + 1;
+
+            diagonal = above;
+            row[j] = cost;
+            if (cost < row_min)
+                row_min = cost;
+        }
+
+        if (row_min > max)
+            return max + 1;
+    }
+
+    best = row[0];
+    for (j = 1; j <= name_length; j++) {
+        if (row[j] < best)
+            best = row[j];
+    }
+
+    return best;
+}
+
+size_t mtrlj_catalog_search(const struct mtrlj_catalog *catalog,
+                            const char *query, size_t max_distance,
+                            const struct mtrlj_district **matches, size_t k)
+{
+    size_t entries = catalog->size + catalog->city_count;
+    char folded[256];
+    size_t row[256];
+    size_t length, entry, found = 0;
+    size_t *scores;
+
+    if (k == 0 || catalog->search_order == NULL)
+        return 0;
+
+    length = mtrlj_fold_name(query, folded, 256);
+    scores = malloc(k * sizeof(size_t));
+
+    for (entry = 0; entry < entries; entry++) {
+        const char *name = mtrlj_search_name(catalog, entry);
+        size_t name_length = strlen(name);
+        size_t distance;
+
+        if (name_length + max_distance < length)
+            continue;
+
+        distance = mtrlj_prefix_distance(folded, length, name, name_length,
+                                         max_distance, row);
+        if (distance > max_distance)
+            continue;
+
+        /* distance first, then shorter names */
+        mtrlj_search_insert(matches, scores, &found, k,
+                            mtrlj_catalog_entry(catalog, entry),
+                            distance * 256 + name_length);
+    }
+
+    free(scores);
+    return found;
+}
+
+/* Number lookups */
+
+#define MTRLJ_ID_TABLE_MAX (1 << 20) /* larger ranges are scanned instead */
+
+enum {
+    MTRLJ_KEY_ID,
+    MTRLJ_KEY_DAILY_STATION,
+    MTRLJ_KEY_HOURLY_STATION
+};
+
+static int mtrlj_district_key(const struct mtrlj_district *district, int key)
+{
+    switch (key) {
+    case MTRLJ_KEY_DAILY_STATION:
+        return district->daily_forecast_station;
+    case MTRLJ_KEY_HOURLY_STATION:
+        return district->hourly_forecast_station;
+    default:
+        return district->id;
+    }
+}
+
+/* Slots hold entry + 1 for values between `*min` and `*min + *count - 1`,
+   0 values (no station) are left out. */
+static size_t *mtrlj_build_id_table(const struct mtrlj_catalog *catalog,
+                                    int key, int *min, size_t *count)
+{
+    size_t entries = catalog->size + catalog->city_count;
+    int low = 0, high = -1;
+    size_t *slots;
+    size_t entry;
+
+    for (entry = 0; entry < entries; entry++) {
+        int value =
+            mtrlj_district_key(mtrlj_catalog_entry(catalog, entry), key);
+
+        if (value == 0)
+            continue;
+        if (high < low) {
+            low = high = value;
+        } else {
+            low = value < low ? value : low;
+            high = value > high ? value : high;
+        }
+    }
+
+    *min = low;
+    *count = high < low ? 0 : (size_t)high - low + 1;
+    if (*count == 0 || *count > MTRLJ_ID_TABLE_MAX)
+        return NULL;
+
+    slots = calloc(*count, sizeof(size_t));
+    for (entry = 0; entry < entries; entry++) {
+        int value =
+            mtrlj_district_key(mtrlj_catalog_entry(catalog, entry), key);
+
+        if (value != 0 && slots[value - low] == 0)
+            slots[value - low] = entry + 1;
+    }
+
+    return slots;
+}
+
+static const struct mtrlj_district *
+mtrlj_lookup_id(const struct mtrlj_catalog *catalog, const size_t *slots,
+                int min, size_t count, int key, int value)
+{
+    size_t entries = catalog->size + catalog->city_count;
+    size_t entry;
+
+    if (value == 0 || value < min || (size_t)(value - min) >= count)
+        return NULL;
+
+    if (slots) {
+        size_t slot = slots[value - min];
+        return slot ? mtrlj_catalog_entry(catalog, slot - 1) : NULL;
+    }
+
+    for (entry = 0; entry < entries; entry++) {
+        const struct mtrlj_district *d = mtrlj_catalog_entry(catalog, entry);
+
+        if (mtrlj_district_key(d, key) == value)
+            return d;
+    }
+
+    return NULL;
+}
+
+static void mtrlj_catalog_build_ids(struct mtrlj_catalog *catalog)
 {
-    const char *DISTRICTS_ENDPOINT =
-        "https://servis.mgm.gov.tr/web/merkezler/ililcesi";
-    char *url_parameter;
-    MTRLJ_CODE return_code = MTRLJ_OK;
-    struct mtrlj_curl_response mcp = {0};
-    cJSON *districts_json = NULL;
-    const cJSON *district_json = NULL;
     size_t i;
 
-    url_parameter = calloc(128, sizeof(char));
-    sprintf(url_parameter, "il=%s", city_name);
+    catalog->plate_count = 1;
+    for (i = 0; i < catalog->city_count; i++) {
+        int plate = catalog->cities[i].city_plate_code;
 
-    if (!mtrlj_curl_get_params(DISTRICTS_ENDPOINT,
-                               (const char **)&url_parameter, 1, &mcp)) {
-        return_code = MTRLJ_REQUEST_FAILED;
-        goto end;
+        if (plate > 0 && (size_t)plate >= catalog->plate_count)
+            catalog->plate_count = plate + 1;
     }
 
-    districts_json = cJSON_Parse(mcp.response);
-    if (districts_json == NULL || !cJSON_IsArray(districts_json)) {
-        return_code = MTRLJ_JSON_PARSING_FAILED;
-        goto end;
+    catalog->plate_slots = calloc(catalog->plate_count, sizeof(size_t));
+    for (i = 0; i < catalog->city_count; i++) {
+        int plate = catalog->cities[i].city_plate_code;
+
+        if (plate > 0 && catalog->plate_slots[plate] == 0)
+            catalog->plate_slots[plate] = i + 1;
     }
 
-    *size = cJSON_GetArraySize(districts_json);
-    *districts = calloc(*size, sizeof(struct mtrlj_district));
+    catalog->id_slots = mtrlj_build_id_table(
+        catalog, MTRLJ_KEY_ID, &catalog->id_min, &catalog->id_count);
+    catalog->daily_station_slots = mtrlj_build_id_table(
+        catalog, MTRLJ_KEY_DAILY_STATION, &catalog->daily_station_min,
+        &catalog->daily_station_count);
+    catalog->hourly_station_slots = mtrlj_build_id_table(
+        catalog, MTRLJ_KEY_HOURLY_STATION, &catalog->hourly_station_min,
+        &catalog->hourly_station_count);
+}
 
-    i = 0;
-    cJSON_ArrayForEach(district_json, districts_json)
-    {
-        MTRLJ_CODE res =
-            mtrlj_json_parse_district(district_json, *districts + i);
+const struct mtrlj_district *
+mtrlj_city_by_plate(const struct mtrlj_catalog *catalog, int plate_code)
+{
+    size_t slot;
 
-        if (res != MTRLJ_OK) {
-            return_code = res;
-            goto end;
-        }
+    if (plate_code <= 0 || (size_t)plate_code >= catalog->plate_count)
+        return NULL;
 
-        i++;
-    }
+    slot = catalog->plate_slots[plate_code];
+    return slot ? catalog->cities + (slot - 1) : NULL;
+}
 
-end:
-    free(url_parameter);
-    cJSON_Delete(districts_json);
-    free(mcp.response);
-    return return_code;
+const struct mtrlj_district *
+mtrlj_district_by_id(const struct mtrlj_catalog *catalog, int id)
+{
+    return mtrlj_lookup_id(catalog, catalog->id_slots, catalog->id_min,
+                           catalog->id_count, MTRLJ_KEY_ID, id);
 }
 
-MTRLJ_CODE mtrlj_latest_situation(struct mtrlj_district district,
-                                  struct mtrlj_situation *situation)
+const struct mtrlj_district *
+mtrlj_district_by_daily_station(const struct mtrlj_catalog *catalog,
+                                int station)
 {
-    const char *LATEST_SITUATION_ENDPOINT =
-        "https://servis.mgm.gov.tr/web/sondurumlar";
-    char *url_parameter;
-    MTRLJ_CODE return_code = MTRLJ_OK;
-    struct mtrlj_curl_response mcp = {0};
-    cJSON *situation_json = NULL;
+    return mtrlj_lookup_id(catalog, catalog->daily_station_slots,
+                           catalog->daily_station_min,
+                           catalog->daily_station_count,
+                           MTRLJ_KEY_DAILY_STATION, station);
+}
 
-    url_parameter = calloc(128, sizeof(char));
-    sprintf(url_parameter, "merkezid=%d", district.id);
+const struct mtrlj_district *
+mtrlj_district_by_hourly_station(const struct mtrlj_catalog *catalog,
+                                 int station)
+{
+    return mtrlj_lookup_id(catalog, catalog->hourly_station_slots,
+                           catalog->hourly_station_min,
+                           catalog->hourly_station_count,
+                           MTRLJ_KEY_HOURLY_STATION, station);
+}
 
-    if (!mtrlj_curl_get_params(LATEST_SITUATION_ENDPOINT,
-                               (const char **)&url_parameter, 1, &mcp)) {
-        return_code = MTRLJ_REQUEST_FAILED;
-        goto end;
-    }
+/* Catalog */
 
-    situation_json = cJSON_Parse(mcp.response);
-    if (situation_json == NULL || !cJSON_IsArray(situation_json)
-        || cJSON_GetArraySize(situation_json) != 1) {
-        return_code = MTRLJ_JSON_PARSING_FAILED;
-        goto end;
-    }
+#define MTRLJ_EARTH_RADIUS 6371.0
+#define MTRLJ_KM_PER_DEGREE (MTRLJ_EARTH_RADIUS * MTRLJ_PI / 180)
+#define MTRLJ_GRID_CELL_SIZE 0.25 /* degrees, ~25 km */
 
-    {
-        cJSON *json = cJSON_GetArrayItem(situation_json, 0);
-        cJSON *actual_pressure = cJSON_GetObjectItem(json, "aktuelBasinc");
-        cJSON *reduced_pressure_at_sea =
-            cJSON_GetObjectItem(json, "denizeIndirgenmisBasinc");
-        cJSON *sea_temperature = cJSON_GetObjectItem(json, "denizSicaklik");
-        cJSON *condition_code = cJSON_GetObjectItem(json, "hadiseKodu");
-        cJSON *cloudiness_percent = cJSON_GetObjectItem(json, "kapalilik");
-        cJSON *snow_height = cJSON_GetObjectItem(json, "karYukseklik");
-        cJSON *humidity_percent = cJSON_GetObjectItem(json, "nem");
-        cJSON *wind_speed = cJSON_GetObjectItem(json, "ruzgarHiz");
-        cJSON *wind_direction = cJSON_GetObjectItem(json, "ruzgarYon");
-        cJSON *temperature = cJSON_GetObjectItem(json, "sicaklik");
-        cJSON *rainfall = cJSON_GetObjectItem(json, "yagis00Now");
-        cJSON *rainfall_10_mins = cJSON_GetObjectItem(json, "yagis10Dk");
-        cJSON *rainfall_1_hour = cJSON_GetObjectItem(json, "yagis1Saat");
-        cJSON *rainfall_6_hours = cJSON_GetObjectItem(json, "yagis6Saat");
-        cJSON *rainfall_12_hours = cJSON_GetObjectItem(json, "yagis12Saat");
-        cJSON *rainfall_24_hours = cJSON_GetObjectItem(json, "yagis24Saat");
-        cJSON *time = cJSON_GetObjectItem(json, "veriZamani");
+double mtrlj_distance(double latitude1, double longitude1, double latitude2,
+                      double longitude2)
+{
+    double phi1 = latitude1 * (MTRLJ_PI / 180);
+    double phi2 = latitude2 * (MTRLJ_PI / 180);
+    double dphi = sin((phi2 - phi1) / 2);
+    double dlambda = sin((longitude2 - longitude1) * (MTRLJ_PI / 180) / 2);
+    double a = dphi * dphi + cos(phi1) * cos(phi2) * dlambda * dlambda;
 
-        /* this is a huge if statement lol */
-        if (!cJSON_IsNumber(actual_pressure)
-            || !cJSON_IsNumber(reduced_pressure_at_sea)
-            || !cJSON_IsNumber(sea_temperature)
-            || !cJSON_IsNumber(cloudiness_percent)
-            || !cJSON_IsNumber(snow_height) || !cJSON_IsNumber(humidity_percent)
-            || !cJSON_IsNumber(wind_speed) || !cJSON_IsNumber(wind_direction)
-            || !cJSON_IsNumber(temperature) || !cJSON_IsNumber(rainfall)
-            || !cJSON_IsNumber(rainfall_10_mins)
-            || !cJSON_IsNumber(rainfall_1_hour)
-            || !cJSON_IsNumber(rainfall_6_hours)
-            || !cJSON_IsNumber(rainfall_12_hours)
-            || !cJSON_IsNumber(rainfall_24_hours) || !cJSON_IsString(time)
-            || (time->valuestring == NULL) || !cJSON_IsString(condition_code)
-            || (condition_code->valuestring == NULL)) {
-            return_code = MTRLJ_JSON_PARSING_FAILED;
-            goto end;
-        }
+    return 2 * MTRLJ_EARTH_RADIUS * asin(sqrt(a < 1 ? a : 1));
+}
 
-        situation->actual_pressure = actual_pressure->valuedouble;
-        situation->reduced_pressure_at_sea =
-            reduced_pressure_at_sea->valuedouble;
-        situation->sea_temperature = sea_temperature->valuedouble;
-        situation->condition =
-            mtrlj_condition_from_code(condition_code->valuestring);
-        situation->cloudiness_percent = cloudiness_percent->valuedouble;
-        situation->snow_height = snow_height->valuedouble;
-        situation->humidity_percent = humidity_percent->valuedouble;
-        situation->wind_speed = wind_speed->valuedouble;
-        situation->wind_direction = wind_direction->valuedouble;
-        situation->temperature = temperature->valuedouble;
-        situation->rainfall = rainfall->valuedouble;
-        situation->rainfall_10_mins = rainfall_10_mins->valuedouble;
-        situation->rainfall_1_hour = rainfall_1_hour->valuedouble;
-        situation->rainfall_6_hours = rainfall_6_hours->valuedouble;
-        situation->rainfall_12_hours = rainfall_12_hours->valuedouble;
-        situation->rainfall_24_hours = rainfall_24_hours->valuedouble;
-        situation->time = mtrlj_parse_iso8601_time(time->valuestring);
+static size_t mtrlj_grid_row(const struct mtrlj_catalog *catalog,
+                             double latitude)
+{
+    double row = (latitude - catalog->grid_latitude) / catalog->grid_cell_size;
 
-        /* looks like mgm returns UTC time here? */
-        situation->time.hour += 3;
-    }
+    if (row < 0)
+        return 0;
+    if (row >= catalog->grid_rows)
+        return catalog->grid_rows - 1;
+    return (size_t)row;
+}
 
-end:
-    free(url_parameter);
-    cJSON_Delete(situation_json);
-    free(mcp.response);
-    return return_code;
+static size_t mtrlj_grid_column(const struct mtrlj_catalog *catalog,
+                                double longitude)
+{
+    double column =
+        (longitude - catalog->grid_longitude) / catalog->grid_cell_size;
+
+    if (column < 0)
+        return 0;
+    if (column >= catalog->grid_columns)
+        return catalog->grid_columns - 1;
+    return (size_t)column;
 }
 
-MTRLJ_CODE mtrlj_five_days_forecast(struct mtrlj_district district,
-                                    struct mtrlj_daily_forecast **forecasts)
+static void mtrlj_catalog_build_grid(struct mtrlj_catalog *catalog)
 {
-    const char *DAILY_FORECAST_ENDPOINT =
-        "https://servis.mgm.gov.tr/web/tahminler/gunluk";
-    char *url_parameter;
-    MTRLJ_CODE return_code = MTRLJ_OK;
-    struct mtrlj_curl_response mcp = {0};
-    cJSON *daily_json = NULL;
+    double min_latitude = 90, max_latitude = -90;
+    double min_longitude = 180, max_longitude = -180;
+    size_t cell_count;
+    size_t *fill;
     size_t i;
 
-    if (district.daily_forecast_station == 0)
-        return MTRLJ_NOT_AVAILABLE;
+    for (i = 0; i < catalog->size; i++) {
+        const struct mtrlj_district *d = catalog->districts + i;
+
+        if (d->latitude < min_latitude)
+            min_latitude = d->latitude;
+        if (d->latitude > max_latitude)
+            max_latitude = d->latitude;
+        if (d->longitude < min_longitude)
+            min_longitude = d->longitude;
+        if (d->longitude > max_longitude)
+            max_longitude = d->longitude;
+    }
 
-    url_parameter = calloc(128, sizeof(char));
-    sprintf(url_parameter, "istno=%d", district.daily_forecast_station);
+    if (catalog->size == 0) {
+        min_latitude = max_latitude = 0;
+        min_longitude = max_longitude = 0;
+    }
 
-    if (!mtrlj_curl_get_params(DAILY_FORECAST_ENDPOINT,
-                               (const char **)&url_parameter, 1, &mcp)) {
-        return_code = MTRLJ_REQUEST_FAILED;
-        goto end;
+    catalog->grid_cell_size = MTRLJ_GRID_CELL_SIZE;
+    catalog->grid_latitude = min_latitude;
+    catalog->grid_longitude = min_longitude;
+    catalog->grid_rows =
+        (size_t)((max_latitude - min_latitude) / MTRLJ_GRID_CELL_SIZE) + 1;
+    catalog->grid_columns =
+        (size_t)((max_longitude - min_longitude) / MTRLJ_GRID_CELL_SIZE) + 1;
+    /* longitude degrees are shortest at the latitude farthest from equator */
+    catalog->grid_min_cos =
+        cos((fabs(min_latitude) > fabs(max_latitude) ? fabs(min_latitude)
+                                                      : fabs(max_latitude))
+            * (MTRLJ_PI / 180));
+
+    /* counting sort of district indexes into cells */
+    cell_count = catalog->grid_rows * catalog->grid_columns;
+    catalog->grid_start = calloc(cell_count + 1, sizeof(size_t));
+    catalog->grid_items = calloc(catalog->size + 1, sizeof(size_t));
+    fill = calloc(cell_count, sizeof(size_t));
+
+    for (i = 0; i < catalog->size; i++) {
+        const struct mtrlj_district *d = catalog->districts + i;
+        size_t cell =
+            mtrlj_grid_row(catalog, d->latitude) * catalog->grid_columns
+            + mtrlj_grid_column(catalog, d->longitude);
+        catalog->grid_start[cell + 1]++;
     }
 
-    daily_json = cJSON_Parse(mcp.response);
-    if (daily_json == NULL || !cJSON_IsArray(daily_json)
-        || cJSON_GetArraySize(daily_json) != 1) {
-        return_code = MTRLJ_JSON_PARSING_FAILED;
-        goto end;
+    for (i = 0; i < cell_count; i++)
+        catalog->grid_start[i + 1] += catalog->grid_start[i];
+
+    for (i = 0; i < catalog->size; i++) {
+        const struct mtrlj_district *d = catalog->districts + i;
+        size_t cell =
+            mtrlj_grid_row(catalog, d->latitude) * catalog->grid_columns
+            + mtrlj_grid_column(catalog, d->longitude);
+        catalog->grid_items[catalog->grid_start[cell] + fill[cell]++] = i;
     }
 
-    *forecasts = calloc(5, sizeof(struct mtrlj_daily_forecast));
+    free(fill);
+}
 
-    {
-        char condition_key[] = "hadiseGun ";
-        char min_temp_key[] = "enDusukGun ";
-        char max_temp_key[] = "enYuksekGun ";
-        char min_humidity_key[] = "enDusukNemGun ";
-        char max_humidity_key[] = "enYuksekNemGun ";
-        char wind_speed_key[] = "ruzgarHizGun ";
-        char wind_direction_key[] = "ruzgarYonGun ";
-        char time_key[] = "tarihGun ";
-        cJSON *condition_code;
-        cJSON *temperature_min;
-        cJSON *temperature_max;
-        cJSON *humidity_min;
-        cJSON *humidity_max;
-        cJSON *wind_speed;
-        cJSON *wind_direction;
-        cJSON *time;
-        cJSON *json = cJSON_GetArrayItem(daily_json, 0);
+void mtrlj_catalog_init(struct mtrlj_catalog *catalog,
+                        struct mtrlj_district *cities, size_t city_count,
+                        struct mtrlj_district *districts, size_t size)
+{
+    memset(catalog, 0, sizeof(*catalog));
+    catalog->cities = cities;
+    catalog->city_count = city_count;
+    catalog->districts = districts;
+    catalog->size = size;
+
+    mtrlj_catalog_build_grid(catalog);
+    mtrlj_catalog_build_names(catalog);
+    mtrlj_catalog_build_search(catalog);
+    mtrlj_catalog_build_ids(catalog);
+}
 
-        for (i = 0; i < 5; i++) {
-            char num = '1' + i;
-            condition_key[9] = num;
-            min_temp_key[10] = num;
-            max_temp_key[11] = num;
-            min_humidity_key[13] = num;
-            max_humidity_key[14] = num;
-            wind_speed_key[12] = num;
-            wind_direction_key[12] = num;
-            time_key[8] = num;
-
-            condition_code = cJSON_GetObjectItem(json, condition_key);
-            temperature_min = cJSON_GetObjectItem(json, min_temp_key);
-            temperature_max = cJSON_GetObjectItem(json, max_temp_key);
-            humidity_min = cJSON_GetObjectItem(json, min_humidity_key);
-            humidity_max = cJSON_GetObjectItem(json, max_humidity_key);
-            wind_speed = cJSON_GetObjectItem(json, wind_speed_key);
-            wind_direction = cJSON_GetObjectItem(json, wind_direction_key);
-            time = cJSON_GetObjectItem(json, time_key);
-
-            if (!cJSON_IsNumber(temperature_min)
-                || !cJSON_IsNumber(temperature_max)
-                || !cJSON_IsNumber(humidity_min)
-                || !cJSON_IsNumber(humidity_max) || !cJSON_IsNumber(wind_speed)
-                || !cJSON_IsNumber(wind_direction)
-                || !cJSON_IsString(condition_code)
-                || (condition_code->valuestring == NULL)
-                || !cJSON_IsString(time) || (time->valuestring == NULL)) {
-                return_code = MTRLJ_JSON_PARSING_FAILED;
-                goto end;
-            }
+#ifndef METEOROLOJI_EMBED_CATALOG
+MTRLJ_CODE mtrlj_catalog_load(struct mtrlj_catalog *catalog)
+{
+    struct mtrlj_district *cities = NULL;
+    struct mtrlj_district *districts = NULL;
+    size_t city_count = 0;
+    size_t size = 0;
+    size_t i;
+    MTRLJ_CODE res;
 
-            (*forecasts)[i].condition =
-                mtrlj_condition_from_code(condition_code->valuestring);
-            (*forecasts)[i].temperature_min = temperature_min->valuedouble;
-            (*forecasts)[i].temperature_max = temperature_max->valuedouble;
-            (*forecasts)[i].humidity_min = humidity_min->valuedouble;
-            (*forecasts)[i].humidity_max = humidity_max->valuedouble;
-            (*forecasts)[i].wind_speed = wind_speed->valuedouble;
-            (*forecasts)[i].wind_direction = wind_direction->valuedouble;
-            (*forecasts)[i].time = mtrlj_parse_iso8601_time(time->valuestring);
-        }
+    mtrlj_call_begin(); /* one deadline for all of the requests */
+
+    res = mtrlj_get_cities(&cities, &city_count);
+    if (res != MTRLJ_OK) {
+        mtrlj_free_ndistrict(cities, city_count);
+        goto end;
     }
 
-    for (i = 0; i < 5; i++) {
-        MTRLJ_CODE res = mtrlj_get_past_values(district.id, *forecasts + i);
+    for (i = 0; i < city_count; i++) {
+        struct mtrlj_district *city_districts = NULL;
+        size_t city_size = 0;
+
+        res = mtrlj_get_districts_in_city(&city_districts, &city_size,
+                                          cities[i].city_name);
         if (res != MTRLJ_OK) {
-            /* It's ok that this is not available, so set the corresponding
-               values to -9999 to inform that these are not available. */
-            (*forecasts)[i].past_peak_temperature_min = -9999;
-            (*forecasts)[i].past_peak_temperature_max = -9999;
-            (*forecasts)[i].past_average_temperature_min = -9999;
-            (*forecasts)[i].past_average_temperature_max = -9999;
+            mtrlj_free_ndistrict(city_districts, city_size);
+            mtrlj_free_ndistrict(cities, city_count);
+            mtrlj_free_ndistrict(districts, size);
+            goto end;
         }
+
+        districts = realloc(districts, (size + city_size)
+                                           * sizeof(struct mtrlj_district));
+        memcpy(districts + size, city_districts,
+               city_size * sizeof(struct mtrlj_district));
+        size += city_size;
+        free(city_districts); /* names are moved, not copied */
     }
 
+    mtrlj_catalog_init(catalog, cities, city_count, districts, size);
+
 end:
-    free(url_parameter);
-    cJSON_Delete(daily_json);
-    free(mcp.response);
-    return return_code;
+    mtrlj_call_end();
+    return res;
+}
+#else
+MTRLJ_CODE mtrlj_catalog_load(struct mtrlj_catalog *catalog)
+{
+    mtrlj_catalog_init(catalog,
+                       mtrlj_embedded_copy(mtrlj_embedded_cities,
+                                           MTRLJ_EMBEDDED_CITY_COUNT),
+                       MTRLJ_EMBEDDED_CITY_COUNT,
+                       mtrlj_embedded_copy(mtrlj_embedded_districts,
+                                           MTRLJ_EMBEDDED_DISTRICT_COUNT),
+                       MTRLJ_EMBEDDED_DISTRICT_COUNT);
+    return MTRLJ_OK;
 }
+#endif
 
-MTRLJ_CODE mtrlj_hourly_forecasts(struct mtrlj_district district,
-                                  struct mtrlj_hourly_forecast **forecasts,
-                                  size_t *size)
+/* Lower bound of the distance between given point and anything outside the
+   rows [row0, row1] and columns [column0, column1] of the grid. */
+static double mtrlj_grid_outside_km(const struct mtrlj_catalog *catalog,
+                                    double latitude, double longitude,
+                                    size_t row0, size_t row1, size_t column0,
+                                    size_t column1)
 {
-    const char *HOURLY_FORECAST_ENDPOINT =
-        "https://servis.mgm.gov.tr/web/tahminler/saatlik";
-    char *url_parameter;
-    MTRLJ_CODE return_code = MTRLJ_OK;
-    struct mtrlj_curl_response mcp = {0};
-    cJSON *hourly_json = NULL;
-    cJSON *forecasts_json = NULL;
-    const cJSON *forecast_json = NULL;
-    size_t i;
+    double bound = HUGE_VAL;
+    double lat_km = MTRLJ_KM_PER_DEGREE;
+    double lon_km = MTRLJ_KM_PER_DEGREE * catalog->grid_min_cos;
+    double size = catalog->grid_cell_size;
+
+    if (row0 > 0)
+        bound = (latitude - (catalog->grid_latitude + row0 * size)) * lat_km;
+    if (row1 + 1 < catalog->grid_rows) {
+        double d =
+            (catalog->grid_latitude + (row1 + 1) * size - latitude) * lat_km;
+        bound = d < bound ? d : bound;
+    }
+    if (column0 > 0) {
+        double d =
+            (longitude - (catalog->grid_longitude + column0 * size)) * lon_km;
+        bound = d < bound ? d : bound;
+    }
+    if (column1 + 1 < catalog->grid_columns) {
+        double d = (catalog->grid_longitude + (column1 + 1) * size - longitude)
+                   * lon_km;
+        bound = d < bound ? d : bound;
+    }
 
-    if (district.hourly_forecast_station == 0)
-        return MTRLJ_NOT_AVAILABLE;
+    return bound < 0 ? 0 : bound;
+}
 
-    url_parameter = calloc(128, sizeof(char));
-    sprintf(url_parameter, "istno=%d", district.hourly_forecast_station);
+size_t mtrlj_nearest_district(const struct mtrlj_catalog *catalog,
+                              double latitude, double longitude, size_t k,
+                              const struct mtrlj_district **nearest)
+{
+    double *distances;
+    size_t found = 0;
+    size_t row, column, ring;
 
-    if (!mtrlj_curl_get_params(HOURLY_FORECAST_ENDPOINT,
-                               (const char **)&url_parameter, 1, &mcp)) {
-        return_code = MTRLJ_REQUEST_FAILED;
-        goto end;
-    }
+    if (k == 0 || catalog->size == 0)
+        return 0;
 
-    hourly_json = cJSON_Parse(mcp.response);
-    if (hourly_json == NULL || !cJSON_IsArray(hourly_json)
-        || cJSON_GetArraySize(hourly_json) != 1) {
-        return_code = MTRLJ_JSON_PARSING_FAILED;
-        goto end;
+    distances = malloc(k * sizeof(double));
+    row = mtrlj_grid_row(catalog, latitude);
+    column = mtrlj_grid_column(catalog, longitude);
+
+    /* visit cells ring by ring around the point until nothing outside can be
+       closer than what we have */
+    for (ring = 0;; ring++) {
+        size_t row0 = row > ring ? row - ring : 0;
+        size_t row1 = row + ring < catalog->grid_rows ? row + ring
+                                                      : catalog->grid_rows - 1;
+        size_t column0 = column > ring ? column - ring : 0;
+        size_t column1 = column + ring < catalog->grid_columns
+                             ? column + ring
+                             : catalog->grid_columns - 1;
+        size_t r, c, i;
+
+        for (r = row0; r <= row1; r++) {
+            for (c = column0; c <= column1; c++) {
+                size_t cell = r * catalog->grid_columns + c;
+                size_t dr = r > row ? r - row : row - r;
+                size_t dc = c > column ? c - column : column - c;
+
+                /* inner cells are visited in previous rings */
+                if ((dr > dc ? dr : dc) != ring)
+                    continue;
+
+                for (i = catalog->grid_start[cell];
+                     i < catalog->grid_start[cell + 1]; i++) {
+                    const struct mtrlj_district *d =
+                        catalog->districts + catalog->grid_items[i];
+                    double distance = mtrlj_distance(latitude, longitude,
+                                                     d->latitude, d->longitude);
+                    size_t j;
+
+                    if (found == k && distance >= distances[k - 1])
+                        continue;
+
+                    /* insertion into the sorted top k */
+                    j = found < k ? found++ : k - 1;
+                    while (j > 0 && distances[j - 1] > distance) {
+                        distances[j] = distances[j - 1];
+                        nearest[j] = nearest[j - 1];
+                        j--;
+                    }
+                    distances[j] = distance;
+                    nearest[j] = d;
+                }
+            }
+        }
+
+        if (row0 == 0 && column0 == 0 && row1 == catalog->grid_rows - 1
+            && column1 == catalog->grid_columns - 1)
+            break;
+        if (found == k
+            && distances[k - 1] <= mtrlj_grid_outside_km(
+                   catalog, latitude, longitude, row0, row1, column0, column1))
+            break;
     }
 
-    forecasts_json =
-        cJSON_GetObjectItem(cJSON_GetArrayItem(hourly_json, 0), "tahmin");
+    free(distances);
+    return found;
+}
 
-    if (forecasts_json == NULL || !cJSON_IsArray(forecasts_json)) {
-        return_code = MTRLJ_JSON_PARSING_FAILED;
-        goto end;
-    }
+size_t mtrlj_districts_within(const struct mtrlj_catalog *catalog,
+                              double latitude, double longitude, double radius,
+                              const struct mtrlj_district **districts,
+                              size_t capacity)
+{
+    double lat_degrees = radius / MTRLJ_KM_PER_DEGREE;
+    double lon_degrees =
+        radius / (MTRLJ_KM_PER_DEGREE * catalog->grid_min_cos);
+    size_t row0, row1, column0, column1, r, c, i;
+    size_t count = 0;
 
-    *size = cJSON_GetArraySize(forecasts_json);
-    *forecasts = calloc(*size, sizeof(struct mtrlj_hourly_forecast));
+    if (catalog->size == 0)
+        return 0;
 
-    i = 0;
-    cJSON_ArrayForEach(forecast_json, forecasts_json)
-    {
-        cJSON *condition_code = cJSON_GetObjectItem(forecast_json, "hadise");
-        cJSON *temperature = cJSON_GetObjectItem(forecast_json, "sicaklik");
-        cJSON *felt_temperature =
-            cJSON_GetObjectItem(forecast_json, "hissedilenSicaklik");
-        cJSON *humidity_percent = cJSON_GetObjectItem(forecast_json, "nem");
-        cJSON *wind_speed_avg =
-            cJSON_GetObjectItem(forecast_json, "ruzgarHizi");
-        cJSON *wind_speed_max =
-            cJSON_GetObjectItem(forecast_json, "maksimumRuzgarHizi");
-        cJSON *wind_direction =
-            cJSON_GetObjectItem(forecast_json, "ruzgarYonu");
-        cJSON *time = cJSON_GetObjectItem(forecast_json, "tarih");
-
-        if (!cJSON_IsNumber(temperature) || !cJSON_IsNumber(felt_temperature)
-            || !cJSON_IsNumber(humidity_percent)
-            || !cJSON_IsNumber(wind_speed_avg)
-            || !cJSON_IsNumber(wind_speed_max)
-            || !cJSON_IsNumber(wind_direction)
-            || !cJSON_IsString(condition_code)
-            || (condition_code->valuestring == NULL) || !cJSON_IsString(time)
-            || (time->valuestring == NULL)) {
-            return_code = MTRLJ_JSON_PARSING_FAILED;
-            goto end;
-        }
+    row0 = mtrlj_grid_row(catalog, latitude - lat_degrees);
+    row1 = mtrlj_grid_row(catalog, latitude + lat_degrees);
+    column0 = mtrlj_grid_column(catalog, longitude - lon_degrees);
+    column1 = mtrlj_grid_column(catalog, longitude + lon_degrees);
 
-        (*forecasts)[i].condition =
-            mtrlj_condition_from_code(condition_code->valuestring);
-        (*forecasts)[i].temperature = temperature->valuedouble;
-        (*forecasts)[i].felt_temperature = felt_temperature->valuedouble;
-        (*forecasts)[i].humidity_percent = humidity_percent->valuedouble;
-        (*forecasts)[i].wind_speed_avg = wind_speed_avg->valuedouble;
-        (*forecasts)[i].wind_speed_max = wind_speed_max->valuedouble;
-        (*forecasts)[i].wind_direction = wind_direction->valuedouble;
-        (*forecasts)[i].time = mtrlj_parse_iso8601_time(time->valuestring);
+    for (r = row0; r <= row1; r++) {
+        for (c = column0; c <= column1; c++) {
+            size_t cell = r * catalog->grid_columns + c;
 
-        i++;
+            for (i = catalog->grid_start[cell];
+                 i < catalog->grid_start[cell + 1]; i++) {
+                const struct mtrlj_district *d =
+                    catalog->districts + catalog->grid_items[i];
+
+                if (mtrlj_distance(latitude, longitude, d->latitude,
+                                   d->longitude)
+                    > radius)
+                    continue;
+
+                if (count < capacity)
+                    districts[count] = d;
+                count++;
+            }
+        }
     }
 
-end:
-    free(url_parameter);
-    cJSON_Delete(hourly_json);
-    free(mcp.response);
-    return return_code;
+    return count;
+}
+
+#ifdef METEOROLOJI_EMBED_CATALOG
+/* Names in the embedded tables can't be freed. Comparing with the table's
+   bounds is fine on every platform we care about. */
+static int mtrlj_is_embedded(const void *p, const void *begin, size_t size)
+{
+    const char *c = (const char *)p;
+    return c >= (const char *)begin && c < (const char *)begin + size;
 }
 
+#define MTRLJ_EMBEDDED(p)                                                      \
+    mtrlj_is_embedded(p, mtrlj_embedded_names, sizeof(mtrlj_embedded_names))
+#else
+#define MTRLJ_EMBEDDED(p) 0
+#endif
+
 void mtrlj_free_district(struct mtrlj_district district)
 {
-    free(district.name);
-    free(district.city_name);
+    if (!MTRLJ_EMBEDDED(district.name))
+        free(district.name);
+    if (!MTRLJ_EMBEDDED(district.city_name))
+        free(district.city_name);
 }
 
 void mtrlj_free_ndistrict(struct mtrlj_district *pdistrict, size_t size)
 {
     size_t i;
+
     for (i = 0; i < size; i++) {
         mtrlj_free_district(pdistrict[i]);
     }
@@ -927,4 +7619,92 @@ void mtrlj_free_hourly_forecasts(struct mtrlj_hourly_forecast *pforecast)
 {
     free(pforecast);
 }
+void mtrlj_free_situation_columns(struct mtrlj_situation_columns *columns)
+{
+    size_t i;
+
+    free(columns->district_id);
+    free(columns->condition);
+    free(columns->time);
+    for (i = 0; i < MTRLJ_SITUATION_FIELD_COUNT; i++) {
+        free(columns->values[i]);
+        free(columns->valid[i]);
+    }
+    memset(columns, 0, sizeof(*columns));
+}
+
+void mtrlj_free_hourly_forecast_columns(
+    struct mtrlj_hourly_forecast_columns *columns)
+{
+    size_t i;
+
+    free(columns->district_id);
+    free(columns->condition);
+    free(columns->time);
+    for (i = 0; i < MTRLJ_HOURLY_FIELD_COUNT; i++) {
+        free(columns->values[i]);
+        free(columns->valid[i]);
+    }
+    memset(columns, 0, sizeof(*columns));
+}
+void mtrlj_free_catalog(struct mtrlj_catalog *catalog)
+{
+    mtrlj_free_ndistrict(catalog->cities, catalog->city_count);
+    mtrlj_free_ndistrict(catalog->districts, catalog->size);
+    free(catalog->grid_start);
+    free(catalog->grid_items);
+    free(catalog->name_slots);
+    free(catalog->search_names);
+    free(catalog->search_offsets);
+    free(catalog->search_order);
+    free(catalog->plate_slots);
+    free(catalog->id_slots);
+    free(catalog->daily_station_slots);
+    free(catalog->hourly_station_slots);
+    memset(catalog, 0, sizeof(*catalog));
+}
+
+void mtrlj_free_change_tracker(struct mtrlj_change_tracker *tracker)
+{
+    free(tracker->slots);
+    memset(tracker, 0, sizeof(*tracker));
+}
+
+void mtrlj_free_poll_schedule(struct mtrlj_poll_schedule *schedule)
+{
+    free(schedule->next_due);
+    free(schedule->cadence);
+    free(schedule->lag);
+    free(schedule->last_data);
+    memset(schedule, 0, sizeof(*schedule));
+}
+
+void mtrlj_free_loop(struct mtrlj_loop *loop)
+{
+    struct mtrlj_loop_transfer *transfer;
+
+    if (!loop)
+        return;
+
+    while ((transfer = loop->transfers) != NULL) {
+        mtrlj_loop_unlink(transfer);
+        transfer->done(transfer, 0);
+        mtrlj_loop_transfer_free(transfer);
+    }
+
+    curl_multi_cleanup(loop->multi);
+    free(loop);
+}
+
+void mtrlj_free_op(struct mtrlj_op *op)
+{
+    if (!op)
+        return;
+
+    if (op->waiting > 0)
+        op->orphaned = 1;
+    else
+        mtrlj_op_release(op);
+}
+
 #endif